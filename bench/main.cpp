@@ -0,0 +1,467 @@
+// triangle_bench: renders fixed headless scenarios for a fixed number of
+// frames and prints the results as JSON, so runs can be compared per commit.
+//
+// With --golden DIR the last frame of every scenario is also compared with
+// DIR/<scenario>.ppm, and the run fails when too many pixels differ beyond
+// the tolerance. The triangle_goldens build target renders the goldens the
+// triangle_tests CTest target checks into tests/golden. Animation advances by a fixed step per frame, so the goldens
+// are only valid for the --warmup and --frames they were written with;
+// --update-golden rewrites them.
+
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Scenario {
+  const char *name;
+  VkExtent2D extent;
+  Scene scene;
+};
+
+const std::vector<Scenario> scenarios = {
+    {"triangle", {800, 600}, {1, 1, 1}},
+    {"triangles_10k", {800, 600}, {1, 10000, 1}},
+    {"triangles_1m", {800, 600}, {1, 1000000, 1}},
+    {"triangles_1m_split", {800, 600}, {1, 1000000, 1, Scene::SPLIT}},
+    {"draws_1k", {800, 600}, {1000, 1, 1}},
+    {"draws_10k", {800, 600}, {10000, 1, 1}},
+    {"pipelines_64", {800, 600}, {1024, 1, 64}},
+    {"instances_10k", {800, 600}, {1, 1, 1, Scene::INTERLEAVED, 10000}},
+    {"instances_100k", {800, 600}, {1, 1, 1, Scene::INTERLEAVED, 100000}},
+    {"instances_1m", {800, 600}, {1, 1, 1, Scene::INTERLEAVED, 1000000}},
+    {"resolution_640x480", {640, 480}, {1, 1, 1}},
+    {"resolution_1280x720", {1280, 720}, {1, 1, 1}},
+    {"resolution_1920x1080", {1920, 1080}, {1, 1, 1}},
+    {"resolution_3840x2160", {3840, 2160}, {1, 1, 1}},
+};
+
+struct Options {
+  uint32_t frames = 300;
+  uint32_t warmup = 30;
+  uint32_t framesInFlight = VulkanRenderer::DEFAULT_FRAMES_IN_FLIGHT;
+  uint32_t recordThreads = 0;
+  uint32_t pipelineThreads = 2;
+  bool cacheCommands = false;
+  bool gpuCulling = false;
+  bool asyncQueues = true;
+  bool dynamicRendering = false;
+  bool validation = false;
+  // Empty leaves the choice to TRIANGLE_DEVICE or the device scoring.
+  std::string device;
+  std::string goldenDir;
+  bool updateGolden = false;
+  // Largest per-channel difference a pixel may have and still match, and
+  // how many pixels may exceed it before a scenario fails.
+  uint32_t tolerance = 2;
+  uint32_t maxMismatched = 0;
+  // Scenarios to run, each named exactly or by part of its name.
+  std::vector<std::string> filters;
+  std::string outputPath = "-";
+  bool list = false;
+};
+
+struct Result {
+  const Scenario *scenario;
+  double seconds;
+  double cpuAvgMs;
+  double cpuP50Ms;
+  double cpuP99Ms;
+  double gpuAvgMs;
+  double gpuP99Ms;
+  // "pass", "fail", "missing" or "updated"; empty without --golden.
+  std::string golden;
+  uint32_t mismatchedPixels;
+  uint32_t maxDifference;
+};
+
+// Binary PPM, the simplest format any image viewer or diff tool reads.
+void writePpm(const std::string &path, VkExtent2D extent,
+              const std::vector<uint8_t> &rgba) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + path + " for writing!");
+  }
+  file << "P6\n" << extent.width << " " << extent.height << "\n255\n";
+  for (size_t i = 0; i < rgba.size(); i += 4) {
+    file.write(reinterpret_cast<const char *>(&rgba[i]), 3);
+  }
+  if (!file) {
+    throw std::runtime_error("failed to write " + path + "!");
+  }
+}
+
+// Returns false when path does not exist.
+bool readPpm(const std::string &path, VkExtent2D &extent,
+             std::vector<uint8_t> &rgb) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+
+  std::string magic;
+  uint32_t maxValue = 0;
+  file >> magic >> extent.width >> extent.height >> maxValue;
+  file.get();
+  if (!file || magic != "P6" || maxValue != 255) {
+    throw std::runtime_error(path + " is not an 8-bit binary PPM!");
+  }
+
+  rgb.resize(size_t(extent.width) * extent.height * 3);
+  file.read(reinterpret_cast<char *>(rgb.data()),
+            static_cast<std::streamsize>(rgb.size()));
+  if (!file) {
+    throw std::runtime_error(path + " is truncated!");
+  }
+  return true;
+}
+
+void checkGolden(VulkanDevice &device, const Scenario &scenario,
+                 const Options &options, Result &result) {
+  std::vector<uint8_t> rgba;
+  VkImage image = device.getSwapChain()
+                      .getSwapChainImages()[device.getRenderer().getLastImageIndex()];
+  device.getFrameCapture().readImage(image, rgba);
+
+  std::string path = options.goldenDir + "/" + scenario.name + ".ppm";
+  if (options.updateGolden) {
+    writePpm(path, scenario.extent, rgba);
+    result.golden = "updated";
+    return;
+  }
+
+  VkExtent2D goldenExtent{};
+  std::vector<uint8_t> golden;
+  if (!readPpm(path, goldenExtent, golden)) {
+    result.golden = "missing";
+    return;
+  }
+  if (goldenExtent.width != scenario.extent.width ||
+      goldenExtent.height != scenario.extent.height) {
+    throw std::runtime_error(path + " does not match the scenario's extent!");
+  }
+
+  for (size_t pixel = 0; pixel * 3 < golden.size(); pixel++) {
+    uint32_t difference = 0;
+    for (size_t channel = 0; channel < 3; channel++) {
+      int actual = rgba[pixel * 4 + channel];
+      int expected = golden[pixel * 3 + channel];
+      difference = std::max(difference,
+                            static_cast<uint32_t>(std::abs(actual - expected)));
+    }
+    result.maxDifference = std::max(result.maxDifference, difference);
+    if (difference > options.tolerance) {
+      result.mismatchedPixels++;
+    }
+  }
+
+  if (result.mismatchedPixels > options.maxMismatched) {
+    result.golden = "fail";
+    // Next to the golden, for comparing the two by eye.
+    writePpm(options.goldenDir + "/" + scenario.name + ".actual.ppm",
+             scenario.extent, rgba);
+  } else {
+    result.golden = "pass";
+  }
+}
+
+uint32_t parseCount(const std::string &flag, const char *value) {
+  if (value == nullptr) {
+    throw std::runtime_error(flag + " requires a value!");
+  }
+  try {
+    return static_cast<uint32_t>(std::stoul(value));
+  } catch (const std::exception &) {
+    throw std::runtime_error(flag + " expects a number, got '" + value + "'!");
+  }
+}
+
+// A filter naming a scenario exactly selects only that one, so "triangle"
+// does not also run every triangles_* scenario.
+bool isSelected(const Scenario &scenario,
+                const std::vector<std::string> &filters) {
+  for (const std::string &filter : filters) {
+    bool exact = std::any_of(scenarios.begin(), scenarios.end(),
+                             [&](const Scenario &other) {
+                               return filter == other.name;
+                             });
+    if (exact ? filter == scenario.name
+              : std::string(scenario.name).find(filter) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Options parseArguments(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *next = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (arg == "--frames") {
+      options.frames = parseCount(arg, next);
+      i++;
+    } else if (arg == "--warmup") {
+      options.warmup = parseCount(arg, next);
+      i++;
+    } else if (arg == "--frames-in-flight") {
+      options.framesInFlight = parseCount(arg, next);
+      i++;
+    } else if (arg == "--record-threads") {
+      options.recordThreads = parseCount(arg, next);
+      i++;
+    } else if (arg == "--pipeline-threads") {
+      options.pipelineThreads = parseCount(arg, next);
+      i++;
+    } else if (arg == "--cache-commands") {
+      options.cacheCommands = true;
+    } else if (arg == "--gpu-culling") {
+      options.gpuCulling = true;
+    } else if (arg == "--no-async-queues") {
+      options.asyncQueues = false;
+    } else if (arg == "--dynamic-rendering") {
+      options.dynamicRendering = true;
+    } else if (arg == "--validation") {
+      options.validation = true;
+    } else if (arg == "--device") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a name or UUID!");
+      }
+      options.device = next;
+      i++;
+    } else if (arg == "--golden") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a directory!");
+      }
+      options.goldenDir = next;
+      i++;
+    } else if (arg == "--update-golden") {
+      options.updateGolden = true;
+    } else if (arg == "--tolerance") {
+      options.tolerance = parseCount(arg, next);
+      i++;
+    } else if (arg == "--max-mismatched") {
+      options.maxMismatched = parseCount(arg, next);
+      i++;
+    } else if (arg == "--scenario") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a name!");
+      }
+      options.filters.push_back(next);
+      i++;
+    } else if (arg == "--output") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a path or '-'!");
+      }
+      options.outputPath = next;
+      i++;
+    } else if (arg == "--list") {
+      options.list = true;
+    } else {
+      throw std::runtime_error("unknown argument: " + arg);
+    }
+  }
+
+  if (options.frames == 0) {
+    throw std::runtime_error("--frames must be at least 1!");
+  }
+  if (options.updateGolden && options.goldenDir.empty()) {
+    throw std::runtime_error("--update-golden requires --golden DIR!");
+  }
+
+  return options;
+}
+
+Result runScenario(const Scenario &scenario, const Options &options,
+                   std::string &deviceName) {
+  DeviceConfig config;
+  config.framesInFlight = options.framesInFlight;
+  config.recordThreads = options.recordThreads;
+  config.pipelineThreads = options.pipelineThreads;
+  config.cacheCommandBuffers = options.cacheCommands;
+  config.gpuCulling = options.gpuCulling;
+  config.asyncQueues = options.asyncQueues;
+  config.dynamicRendering = options.dynamicRendering;
+  config.pipelineCachePath.clear();
+  config.device = options.device;
+  // Every scenario picks the device afresh rather than trusting a file
+  // another configuration wrote.
+  config.deviceCachePath.clear();
+  config.gpuProfiling = true;
+  config.validation = options.validation;
+  config.verbose = false;
+  config.scene = scenario.scene;
+
+  VulkanDevice device(scenario.extent, config);
+  VulkanRenderer &renderer = device.getRenderer();
+  FrameStats &frameStats = renderer.getFrameStats();
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+  deviceName = properties.deviceName;
+
+  // Measure the scenario's own pipelines, not the fallback.
+  device.getPipeLineManager().waitIdle();
+
+  for (uint32_t frame = 0; frame < options.warmup; frame++) {
+    renderer.drawFrame();
+  }
+  vkDeviceWaitIdle(device.getDevice());
+  frameStats.reset();
+  device.getProfiler().resetStats();
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t frame = 0; frame < options.frames; frame++) {
+    renderer.drawFrame();
+    // Nothing else drains the sample ring here; keep it from wrapping.
+    if (frame % 256 == 255) {
+      frameStats.getTotals();
+    }
+  }
+  vkDeviceWaitIdle(device.getDevice());
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  FrameStats::Totals totals = frameStats.getTotals();
+  const LatencyHistogram &cpu = totals.histograms[FrameStats::CPU];
+
+  Result result{&scenario, elapsed.count(), cpu.mean() / 1000.0,
+                cpu.percentile(50) / 1000.0, cpu.percentile(99) / 1000.0,
+                0.0, 0.0, "", 0, 0};
+
+  // Timestamps of the last frames in flight are still unread, but only the
+  // "render_pass" scope matters and it has plenty of samples by now.
+  for (const auto &scope : device.getProfiler().getStats()) {
+    if (scope.name == "render_pass") {
+      result.gpuAvgMs = scope.avgMs;
+      result.gpuP99Ms = scope.p99Ms;
+    }
+  }
+
+  if (!options.goldenDir.empty()) {
+    checkGolden(device, scenario, options, result);
+  }
+
+  return result;
+}
+
+void writeJson(std::ostream &out, const Options &options,
+               const std::string &deviceName,
+               const std::vector<Result> &results) {
+  out << std::fixed << std::setprecision(4);
+  out << "{\n";
+  out << "  \"device\": \"" << deviceName << "\",\n";
+  out << "  \"frames\": " << options.frames << ",\n";
+  out << "  \"warmup\": " << options.warmup << ",\n";
+  out << "  \"frames_in_flight\": " << options.framesInFlight << ",\n";
+  out << "  \"record_threads\": " << options.recordThreads << ",\n";
+  out << "  \"pipeline_threads\": " << options.pipelineThreads << ",\n";
+  out << "  \"cache_commands\": " << (options.cacheCommands ? "true" : "false")
+      << ",\n";
+  out << "  \"gpu_culling\": " << (options.gpuCulling ? "true" : "false")
+      << ",\n";
+  out << "  \"async_queues\": " << (options.asyncQueues ? "true" : "false")
+      << ",\n";
+  out << "  \"dynamic_rendering\": "
+      << (options.dynamicRendering ? "true" : "false") << ",\n";
+  out << "  \"scenarios\": [";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &result = results[i];
+    const Scenario &scenario = *result.scenario;
+    double fps = options.frames / result.seconds;
+    double draws = double(scenario.scene.drawCount) * fps;
+    double triangles = draws * scenario.scene.trianglesPerDraw *
+                       scenario.scene.instanceCount;
+
+    out << (i == 0 ? "\n" : ",\n");
+    out << "    {\"name\": \"" << scenario.name << "\", "
+        << "\"width\": " << scenario.extent.width << ", "
+        << "\"height\": " << scenario.extent.height << ", "
+        << "\"draws\": " << scenario.scene.drawCount << ", "
+        << "\"triangles_per_draw\": " << scenario.scene.trianglesPerDraw << ", "
+        << "\"pipelines\": " << scenario.scene.pipelineCount << ", "
+        << "\"instances\": " << scenario.scene.instanceCount << ",\n"
+        << "     \"fps\": " << fps << ", "
+        << "\"cpu_ms_per_frame\": {\"avg\": " << result.cpuAvgMs
+        << ", \"p50\": " << result.cpuP50Ms << ", \"p99\": " << result.cpuP99Ms
+        << "}, "
+        << "\"gpu_ms_per_frame\": {\"avg\": " << result.gpuAvgMs
+        << ", \"p99\": " << result.gpuP99Ms << "},\n"
+        << "     \"draws_per_sec\": " << draws << ", "
+        << "\"triangles_per_sec\": " << triangles;
+    if (!result.golden.empty()) {
+      out << ",\n     \"golden\": \"" << result.golden << "\", "
+          << "\"mismatched_pixels\": " << result.mismatchedPixels << ", "
+          << "\"max_difference\": " << result.maxDifference;
+    }
+    out << "}";
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    Options options = parseArguments(argc, argv);
+
+    if (options.list) {
+      for (const auto &scenario : scenarios) {
+        std::cout << scenario.name << std::endl;
+      }
+      return EXIT_SUCCESS;
+    }
+
+    std::string deviceName;
+    std::vector<Result> results;
+    for (const auto &scenario : scenarios) {
+      if (!options.filters.empty() && !isSelected(scenario, options.filters)) {
+        continue;
+      }
+      std::cerr << "running " << scenario.name << "..." << std::endl;
+      results.push_back(runScenario(scenario, options, deviceName));
+    }
+
+    if (results.empty()) {
+      throw std::runtime_error("no scenario matches the --scenario filters!");
+    }
+
+    if (options.outputPath == "-") {
+      writeJson(std::cout, options, deviceName, results);
+    } else {
+      std::ofstream file(options.outputPath);
+      if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + options.outputPath +
+                                 " for writing!");
+      }
+      writeJson(file, options, deviceName, results);
+    }
+
+    bool passed = true;
+    for (const Result &result : results) {
+      if (result.golden == "fail" || result.golden == "missing") {
+        std::cerr << result.scenario->name << ": golden image "
+                  << result.golden << std::endl;
+        passed = false;
+      }
+    }
+    if (!passed) {
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,51 @@
+# Turns a SPIR-V binary into a header holding its words as a constexpr array.
+#
+# Invoked at build time as
+#   cmake -DINPUT=<file.spv> -DOUTPUT=<header.h> -DSYMBOL=<name> -P EmbedSpirv.cmake
+
+foreach(var INPUT OUTPUT SYMBOL)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "EmbedSpirv.cmake: ${var} is not set")
+  endif()
+endforeach()
+
+file(READ "${INPUT}" hex HEX)
+string(LENGTH "${hex}" hexLength)
+math(EXPR remainder "${hexLength} % 8")
+if(hexLength EQUAL 0 OR NOT remainder EQUAL 0)
+  message(FATAL_ERROR "${INPUT} is not a whole number of SPIR-V words")
+endif()
+
+# glslc and spirv-opt write little-endian words; anything else would not
+# start with the magic number once byte-swapped below.
+string(SUBSTRING "${hex}" 0 8 magic)
+if(NOT magic STREQUAL "03022307")
+  message(FATAL_ERROR "${INPUT} is not a little-endian SPIR-V module")
+endif()
+
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " words "${hex}")
+# CMake regexes have no {n} repetition, so spell out eight words per line.
+set(word "0x[0-9a-f]+, ")
+string(REGEX REPLACE "(${word}${word}${word}${word}${word}${word}${word}0x[0-9a-f]+,) "
+       "\\1\n    " words "${words}")
+string(REGEX REPLACE ", *\n? *$" "" words "${words}")
+
+string(TOUPPER "SHADERS_${SYMBOL}_H" guard)
+get_filename_component(source "${INPUT}" NAME)
+
+file(WRITE "${OUTPUT}"
+"// Generated from ${source} by cmake/EmbedSpirv.cmake. Do not edit.
+#ifndef ${guard}
+#define ${guard}
+
+#include <cstdint>
+
+namespace shaders {
+
+inline constexpr uint32_t ${SYMBOL}[] = {
+    ${words}};
+
+} // namespace shaders
+
+#endif
+")
@@ -0,0 +1,52 @@
+# Build-time GLSL -> SPIR-V compilation. Each shader is compiled with glslc,
+# optimized with spirv-opt when it is available, and embedded into a
+# generated header (shaders/<name>_<stage>.h) as a constexpr uint32_t array,
+# so the executable never reads shader files at runtime.
+
+find_program(GLSLC_EXECUTABLE glslc
+  HINTS "${Vulkan_GLSLC_EXECUTABLE}" "$ENV{VULKAN_SDK}/bin" REQUIRED)
+find_program(SPIRV_OPT_EXECUTABLE spirv-opt HINTS "$ENV{VULKAN_SDK}/bin")
+
+if(NOT SPIRV_OPT_EXECUTABLE)
+  message(STATUS "spirv-opt not found, embedding glslc -O output unchanged")
+endif()
+
+set(SHADER_INCLUDE_DIR "${CMAKE_CURRENT_BINARY_DIR}/generated")
+
+# embed_shaders(<target> <shader sources...>)
+function(embed_shaders target)
+  set(headers)
+  foreach(shader ${ARGN})
+    get_filename_component(shaderPath "${shader}" ABSOLUTE)
+    get_filename_component(shaderName "${shader}" NAME)
+    string(REPLACE "." "_" symbol "${shaderName}")
+
+    set(spirvDir "${CMAKE_CURRENT_BINARY_DIR}/shaders")
+    set(spirv "${spirvDir}/${shaderName}.spv")
+    set(header "${SHADER_INCLUDE_DIR}/shaders/${symbol}.h")
+
+    if(SPIRV_OPT_EXECUTABLE)
+      set(compiled "${spirvDir}/${shaderName}.unopt.spv")
+      set(optimize COMMAND "${SPIRV_OPT_EXECUTABLE}" -O "${compiled}" -o "${spirv}")
+    else()
+      set(compiled "${spirv}")
+      set(optimize)
+    endif()
+
+    add_custom_command(
+      OUTPUT "${header}"
+      COMMAND "${CMAKE_COMMAND}" -E make_directory "${spirvDir}" "${SHADER_INCLUDE_DIR}/shaders"
+      COMMAND "${GLSLC_EXECUTABLE}" --target-env=vulkan1.3 -O "${shaderPath}" -o "${compiled}"
+      ${optimize}
+      COMMAND "${CMAKE_COMMAND}" -DINPUT=${spirv} -DOUTPUT=${header} -DSYMBOL=${symbol}
+              -P "${PROJECT_SOURCE_DIR}/cmake/EmbedSpirv.cmake"
+      DEPENDS "${shaderPath}" "${PROJECT_SOURCE_DIR}/cmake/EmbedSpirv.cmake"
+      COMMENT "Compiling and embedding ${shaderName}"
+      VERBATIM)
+
+    list(APPEND headers "${header}")
+  endforeach()
+
+  target_sources(${target} PRIVATE ${headers})
+  target_include_directories(${target} PRIVATE "${SHADER_INCLUDE_DIR}")
+endfunction()
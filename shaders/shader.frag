@@ -3,6 +3,10 @@
 layout(location = 0) out vec4 outColor;
 layout(location = 0) in vec3 fragColor;
 
+// Set per pipeline variant, which keeps otherwise identical variants
+// distinct pipelines.
+layout(constant_id = 0) const uint VARIANT = 0;
+
 void main() {
   outColor = vec4(fragColor, 1.0);
 }
@@ -1,20 +1,35 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(set = 0, binding = 0) uniform FrameData {
+  vec4 tint;
+} frame;
+
+// Structure of arrays: offset x, offset y, scale and packed RGBA8 color,
+// each draw.instanceCount words long.
+layout(std430, set = 1, binding = 0) readonly buffer Instances {
+  uint words[];
+} instances;
 
-vec2 positions[3] = vec2[](
-  vec2(0.0, -0.5),
-  vec2(0.5, 0.5),
-  vec2(-0.5, 0.5)
-);
+layout(push_constant) uniform DrawConstants {
+  vec2 offset;
+  float scale;
+  uint instanceCount;
+} draw;
 
-vec3 colors[3] = vec3[](
-  vec3(1.0, 0.0, 0.0),
-  vec3(0.0, 1.0, 0.0),
-  vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
 
 void main() {
-  gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-  fragColor = colors[gl_VertexIndex];
+  uint i = gl_InstanceIndex;
+  uint n = draw.instanceCount;
+  vec2 instanceOffset = vec2(uintBitsToFloat(instances.words[i]),
+                             uintBitsToFloat(instances.words[n + i]));
+  float instanceScale = uintBitsToFloat(instances.words[2 * n + i]);
+  vec4 instanceColor = unpackUnorm4x8(instances.words[3 * n + i]);
+
+  vec2 position = inPosition * instanceScale + instanceOffset;
+  gl_Position = vec4(position * draw.scale + draw.offset, 0.0, 1.0);
+  fragColor = inColor * instanceColor.rgb * frame.tint.rgb;
 }
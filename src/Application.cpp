@@ -1,22 +1,256 @@
 #include "Application.h"
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
-Application::Application() {
-  window = std::make_unique<Window>(WIDTH, HEIGHT, "Vulkan Triangle");
-  device = std::make_unique<VulkanDevice>(*window);
+static double parseMilliseconds(const std::string &flag, const char *value) {
+  if (value == nullptr) {
+    throw std::runtime_error(flag + " requires a value!");
+  }
+  try {
+    return std::stod(value);
+  } catch (const std::exception &) {
+    throw std::runtime_error(flag + " expects a number, got '" + value + "'!");
+  }
+}
+
+static uint32_t parseCount(const std::string &flag, const char *value) {
+  if (value == nullptr) {
+    throw std::runtime_error(flag + " requires a value!");
+  }
+  try {
+    return static_cast<uint32_t>(std::stoul(value));
+  } catch (const std::exception &) {
+    throw std::runtime_error(flag + " expects a number, got '" + value + "'!");
+  }
+}
+
+Application::Options Application::parseArguments(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const char *next = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--frames") {
+      options.frames = parseCount(arg, next);
+      i++;
+    } else if (arg == "--frames-in-flight") {
+      options.device.framesInFlight = parseCount(arg, next);
+      i++;
+    } else if (arg == "--record-threads") {
+      options.device.recordThreads = parseCount(arg, next);
+      i++;
+    } else if (arg == "--cache-commands") {
+      options.device.cacheCommandBuffers = true;
+    } else if (arg == "--gpu-culling") {
+      options.device.gpuCulling = true;
+    } else if (arg == "--no-async-queues") {
+      options.device.asyncQueues = false;
+    } else if (arg == "--dynamic-rendering") {
+      options.device.dynamicRendering = true;
+    } else if (arg == "--pipeline-cache") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a path!");
+      }
+      options.device.pipelineCachePath = next;
+      i++;
+    } else if (arg == "--pipeline-threads") {
+      options.device.pipelineThreads = parseCount(arg, next);
+      i++;
+    } else if (arg == "--no-pipeline-cache") {
+      options.device.pipelineCachePath.clear();
+    } else if (arg == "--device") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a name or UUID!");
+      }
+      options.device.device = next;
+      i++;
+    } else if (arg == "--no-device-cache") {
+      options.device.deviceCachePath.clear();
+    } else if (arg == "--capture") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a path or '-'!");
+      }
+      options.device.capturePath = next;
+      i++;
+    } else if (arg == "--capture-format") {
+      std::string format = next != nullptr ? next : "";
+      if (format == "rgba") {
+        options.device.captureFormat = VulkanFrameCapture::RAW_RGBA;
+      } else if (format == "y4m") {
+        options.device.captureFormat = VulkanFrameCapture::Y4M;
+      } else {
+        throw std::runtime_error(arg + " expects rgba or y4m!");
+      }
+      i++;
+    } else if (arg == "--capture-fps") {
+      options.device.captureFps = parseCount(arg, next);
+      i++;
+    } else if (arg == "--gpu-profile") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a path!");
+      }
+      options.gpuProfilePath = next;
+      options.device.gpuProfiling = true;
+      i++;
+    } else if (arg == "--pipeline-stats") {
+      options.device.pipelineStatistics = true;
+    } else if (arg == "--frame-stats") {
+      if (next == nullptr) {
+        throw std::runtime_error(arg + " requires a path or '-'!");
+      }
+      options.frameStatsPath = next;
+      i++;
+    } else if (arg == "--frame-stats-period-ms") {
+      options.frameStatsPeriodMs = parseCount(arg, next);
+      i++;
+    } else if (arg == "--memory-stats") {
+      options.memoryStats = true;
+    } else if (arg == "--frame-budget-ms") {
+      options.frameBudgetMs = parseMilliseconds(arg, next);
+      i++;
+    } else {
+      throw std::runtime_error("unknown argument: " + arg);
+    }
+  }
+
+  if (options.headless && options.frames == 0) {
+    throw std::runtime_error("--headless requires --frames N!");
+  }
+  // Frames streamed to stdout must not be interleaved with log output.
+  if (options.device.capturePath == "-") {
+    if (options.frameStatsPath == "-") {
+      throw std::runtime_error("--capture - and --frame-stats - both need stdout!");
+    }
+    options.device.verbose = false;
+  }
+
+  return options;
+}
+
+Application::Application(const Options &options) : options(options) {
+  if (options.headless) {
+    VkExtent2D extent = {static_cast<uint32_t>(WIDTH),
+                         static_cast<uint32_t>(HEIGHT)};
+    device = std::make_unique<VulkanDevice>(extent, options.device);
+  } else {
+    window = std::make_unique<Window>(WIDTH, HEIGHT, "Vulkan Triangle");
+    device = std::make_unique<VulkanDevice>(*window, options.device);
+  }
 }
 
 Application::~Application() {}
 
-void Application::run() { mainLoop(); }
+void Application::run() {
+  if (options.headless) {
+    headlessLoop();
+  } else {
+    mainLoop();
+  }
+
+  writeGpuProfile();
+
+  if (options.memoryStats) {
+    device->getMemoryAllocator().writeStats(console());
+    device->getHostAllocator().writeStats(console());
+  }
+}
 
 void Application::mainLoop() {
-  std::cout << "Window should be open now..." << std::endl;
+  console() << "Window should be open now..." << std::endl;
 
-  while (!window->shouldClose()) {
+  auto start = std::chrono::steady_clock::now();
+  startFrameStats();
+
+  uint32_t frame = 0;
+  while (!window->shouldClose() &&
+         (options.frames == 0 || frame < options.frames)) {
     window->pollEvents();
     device->getRenderer().drawFrame();
+    frame++;
+  }
+
+  vkDeviceWaitIdle(device->getDevice());
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stopFrameStats(elapsed.count());
+
+  console() << "Window closed." << std::endl;
+}
+
+void Application::headlessLoop() {
+  auto start = std::chrono::steady_clock::now();
+  startFrameStats();
+
+  for (uint32_t frame = 0; frame < options.frames; frame++) {
+    device->getRenderer().drawFrame();
+  }
+
+  vkDeviceWaitIdle(device->getDevice());
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  stopFrameStats(elapsed.count());
+
+  console() << "Rendered " << options.frames << " headless frames in "
+            << elapsed.count() * 1000.0 << " ms ("
+            << options.frames / elapsed.count() << " fps)" << std::endl;
+}
+
+std::ostream &Application::console() const {
+  return options.device.capturePath == "-" ? std::cerr : std::cout;
+}
+
+void Application::startFrameStats() {
+  if (options.frameStatsPath.empty()) return;
+
+  FrameStats &frameStats = device->getRenderer().getFrameStats();
+  frameStats.setFrameBudget(std::chrono::microseconds(
+      static_cast<int64_t>(options.frameBudgetMs * 1000.0)));
+
+  std::ostream *out = &std::cout;
+  if (options.frameStatsPath != "-") {
+    frameStatsFile.open(options.frameStatsPath);
+    if (!frameStatsFile.is_open()) {
+      throw std::runtime_error("failed to open " + options.frameStatsPath +
+                               " for writing!");
+    }
+    out = &frameStatsFile;
   }
 
-  std::cout << "Window closed." << std::endl;
+  frameStats.startReporter(*out,
+                           std::chrono::milliseconds(options.frameStatsPeriodMs));
+}
+
+void Application::stopFrameStats(double seconds) {
+  if (options.frameStatsPath.empty()) return;
+
+  FrameStats &frameStats = device->getRenderer().getFrameStats();
+  frameStats.stopReporter();
+
+  std::ostream &out = frameStatsFile.is_open() ? frameStatsFile : std::cout;
+  frameStats.writeSummary(out, "total", frameStats.getTotals(), seconds);
+}
+
+void Application::writeGpuProfile() {
+  if (options.gpuProfilePath.empty()) return;
+
+  const std::string &path = options.gpuProfilePath;
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open " + path + " for writing!");
+  }
+
+  bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+  if (csv) {
+    device->getProfiler().writeCsv(file);
+  } else {
+    device->getProfiler().writeJson(file);
+  }
 }
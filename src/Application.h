@@ -3,11 +3,28 @@
 
 #include "VulkanDevice.h"
 #include "Window.h"
+#include <fstream>
 #include <memory>
 
 class Application {
 public:
-  Application();
+  struct Options {
+    bool headless = false;
+    uint32_t frames = 0;
+    DeviceConfig device;
+    // GPU profile dump written on exit; .csv selects CSV, anything else JSON.
+    std::string gpuProfilePath;
+    // Periodic CPU frame timing summaries; "-" writes to stdout.
+    std::string frameStatsPath;
+    uint32_t frameStatsPeriodMs = 1000;
+    double frameBudgetMs = 1000.0 / 60.0;
+    // Prints per-heap allocator usage and driver host allocations on exit.
+    bool memoryStats = false;
+  };
+
+  static Options parseArguments(int argc, char **argv);
+
+  explicit Application(const Options &options);
   ~Application();
 
   void run();
@@ -16,10 +33,18 @@ private:
   static constexpr int WIDTH = 800;
   static constexpr int HEIGHT = 600;
 
+  Options options;
   std::unique_ptr<Window> window;
   std::unique_ptr<VulkanDevice> device;
+  std::ofstream frameStatsFile;
 
+  // stdout, unless captured frames are streamed there.
+  std::ostream &console() const;
   void mainLoop();
+  void headlessLoop();
+  void startFrameStats();
+  void stopFrameStats(double seconds);
+  void writeGpuProfile();
 };
 
 #endif
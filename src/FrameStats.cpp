@@ -0,0 +1,257 @@
+#include "FrameStats.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <utility>
+
+LatencyHistogram::LatencyHistogram()
+    : counts(SUB_BUCKET_COUNT + (32 - SUB_BUCKET_BITS) * SUB_BUCKET_HALF) {}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+  if (value < SUB_BUCKET_COUNT) {
+    return static_cast<size_t>(value);
+  }
+
+  unsigned msb = 63 - __builtin_clzll(value);
+  unsigned shift = msb - (SUB_BUCKET_BITS - 1);
+  uint64_t subBucket = value >> shift;
+  return static_cast<size_t>(SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF +
+                             (subBucket - SUB_BUCKET_HALF));
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+  if (index < SUB_BUCKET_COUNT) {
+    return index;
+  }
+
+  uint64_t offset = index - SUB_BUCKET_COUNT;
+  unsigned shift = static_cast<unsigned>(offset / SUB_BUCKET_HALF) + 1;
+  uint64_t subBucket = offset % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+  return (subBucket << shift) + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+  value = std::min<uint64_t>(value, UINT32_MAX);
+  counts[bucketIndex(value)]++;
+  total++;
+  sum += value;
+  maxValue = std::max(maxValue, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < counts.size(); i++) {
+    counts[i] += other.counts[i];
+  }
+  total += other.total;
+  sum += other.sum;
+  maxValue = std::max(maxValue, other.maxValue);
+}
+
+void LatencyHistogram::reset() {
+  std::fill(counts.begin(), counts.end(), 0);
+  total = 0;
+  sum = 0;
+  maxValue = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  if (total == 0) return 0;
+
+  uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+  rank = std::clamp<uint64_t>(rank, 1, total);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return std::min(bucketUpperBound(i), maxValue);
+    }
+  }
+  return maxValue;
+}
+
+const std::array<const char *, FrameStats::STAGE_COUNT> FrameStats::stageNames = {
+    "wait", "acquire", "record", "submit", "present"};
+
+// Marks a sample whose frame had no predecessor to measure an interval from.
+static constexpr uint32_t NO_INTERVAL = UINT32_MAX;
+
+static uint32_t toMicroseconds(std::chrono::steady_clock::duration duration) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration);
+  return static_cast<uint32_t>(
+      std::min<int64_t>(us.count(), NO_INTERVAL - 1));
+}
+
+FrameStats::FrameStats() : ring(RING_SIZE) {}
+
+FrameStats::~FrameStats() { stopReporter(); }
+
+void FrameStats::setFrameBudget(std::chrono::microseconds budget) {
+  std::lock_guard<std::mutex> lock(consumerMutex);
+  budgetUs = static_cast<uint32_t>(budget.count());
+}
+
+void FrameStats::beginFrame() {
+  Clock::time_point now = Clock::now();
+
+  current.fill(0);
+  current[INTERVAL] =
+      hasPreviousFrame ? toMicroseconds(now - previousFrameStart) : NO_INTERVAL;
+
+  previousFrameStart = now;
+  hasPreviousFrame = true;
+  frameStart = now;
+  lastMark = now;
+}
+
+void FrameStats::endStage(Stage stage) {
+  Clock::time_point now = Clock::now();
+  current[stage] += toMicroseconds(now - lastMark);
+  lastMark = now;
+}
+
+void FrameStats::endFrame() {
+  current[CPU] = toMicroseconds(lastMark - frameStart);
+
+  uint64_t index = writeIndex.load(std::memory_order_relaxed);
+  // Pairs with the acquire fence in drain(): a reader that observes any of
+  // the fields below also observes every earlier write index.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  Slot &slot = ring[index % RING_SIZE];
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    slot.fields[i].store(current[i], std::memory_order_relaxed);
+  }
+
+  writeIndex.store(index + 1, std::memory_order_release);
+}
+
+void FrameStats::drain() {
+  uint64_t head = writeIndex.load(std::memory_order_acquire);
+
+  if (head - readIndex > RING_SIZE) {
+    uint64_t lost = head - readIndex - RING_SIZE;
+    totals.droppedSamples += lost;
+    window.droppedSamples += lost;
+    readIndex = head - RING_SIZE;
+  }
+
+  for (; readIndex < head; readIndex++) {
+    std::array<uint32_t, FIELD_COUNT> sample;
+    const Slot &slot = ring[readIndex % RING_SIZE];
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+      sample[i] = slot.fields[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Once the writer has reached this slot's next lap it may have been
+    // halfway through overwriting it while we copied.
+    if (writeIndex.load(std::memory_order_relaxed) - readIndex >= RING_SIZE) {
+      totals.droppedSamples++;
+      window.droppedSamples++;
+      continue;
+    }
+
+    for (Totals *target : {&totals, &window}) {
+      target->frames++;
+      for (size_t i = 0; i < FIELD_COUNT; i++) {
+        if (i == INTERVAL && sample[i] == NO_INTERVAL) continue;
+        target->histograms[i].record(sample[i]);
+      }
+      if (sample[INTERVAL] != NO_INTERVAL && sample[INTERVAL] > budgetUs) {
+        target->missedFrames++;
+      }
+    }
+  }
+}
+
+FrameStats::Totals FrameStats::getTotals() {
+  std::lock_guard<std::mutex> lock(consumerMutex);
+  drain();
+  return totals;
+}
+
+void FrameStats::reset() {
+  std::lock_guard<std::mutex> lock(consumerMutex);
+  drain();
+  totals = Totals();
+  window = Totals();
+}
+
+void FrameStats::startReporter(std::ostream &out,
+                               std::chrono::milliseconds period) {
+  stopReporter();
+
+  {
+    std::lock_guard<std::mutex> lock(consumerMutex);
+    drain();
+    window = Totals();
+  }
+
+  stopRequested = false;
+  reporter = std::thread(&FrameStats::reporterLoop, this, std::ref(out), period);
+}
+
+void FrameStats::stopReporter() {
+  if (!reporter.joinable()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(reporterMutex);
+    stopRequested = true;
+  }
+  reporterWake.notify_all();
+  reporter.join();
+}
+
+void FrameStats::reporterLoop(std::ostream &out,
+                              std::chrono::milliseconds period) {
+  Clock::time_point windowStart = Clock::now();
+  std::unique_lock<std::mutex> lock(reporterMutex);
+
+  while (!reporterWake.wait_for(lock, period, [this] { return stopRequested; })) {
+    Totals snapshot;
+    {
+      std::lock_guard<std::mutex> consumerLock(consumerMutex);
+      drain();
+      snapshot = std::move(window);
+      window = Totals();
+    }
+
+    Clock::time_point now = Clock::now();
+    writeSummary(out, "frames", snapshot,
+                 std::chrono::duration<double>(now - windowStart).count());
+    windowStart = now;
+  }
+}
+
+void FrameStats::writeSummary(std::ostream &out, const char *label,
+                              const Totals &totals, double seconds) const {
+  auto ms = [](uint64_t us) { return us / 1000.0; };
+  const LatencyHistogram &interval = totals.histograms[INTERVAL];
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(2);
+
+  out << '[' << label << "] " << totals.frames << " frames";
+  if (seconds > 0.0) {
+    out << " in " << seconds << " s (" << totals.frames / seconds << " fps)";
+  }
+  out << ", missed " << totals.missedFrames;
+  if (totals.droppedSamples > 0) {
+    out << ", dropped " << totals.droppedSamples;
+  }
+
+  out << " | interval p50 " << ms(interval.percentile(50)) << " p95 "
+      << ms(interval.percentile(95)) << " p99 " << ms(interval.percentile(99))
+      << " max " << ms(interval.max()) << " ms";
+
+  out << " | cpu p99 " << ms(totals.histograms[CPU].percentile(99)) << " ms |";
+  for (size_t stage = 0; stage < STAGE_COUNT; stage++) {
+    out << ' ' << stageNames[stage] << ' '
+        << ms(totals.histograms[stage].percentile(99));
+  }
+  out << " ms p99" << std::endl;
+
+  out.flags(flags);
+}
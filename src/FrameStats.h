@@ -0,0 +1,128 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Log-linear histogram in the style of HdrHistogram: values below 128 get a
+// bucket each, larger values are bucketed with 6 bits of mantissa, which keeps
+// every recorded value within ~1.6% of its true value at any magnitude.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void record(uint64_t value);
+  void merge(const LatencyHistogram &other);
+  void reset();
+
+  uint64_t count() const { return total; }
+  uint64_t max() const { return maxValue; }
+  double mean() const { return total == 0 ? 0.0 : double(sum) / total; }
+  // p in [0, 100]; returns the upper bound of the bucket holding that rank.
+  uint64_t percentile(double p) const;
+
+private:
+  static constexpr unsigned SUB_BUCKET_BITS = 7;
+  static constexpr uint64_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+  static constexpr uint64_t SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t maxValue = 0;
+
+  static size_t bucketIndex(uint64_t value);
+  static uint64_t bucketUpperBound(size_t index);
+};
+
+// CPU-side frame timing. The render thread stamps each stage of a frame and
+// pushes the result into a single-producer ring without locking; a reporter
+// thread drains the ring into histograms and prints a summary periodically.
+class FrameStats {
+public:
+  enum Stage { WAIT, ACQUIRE, RECORD, SUBMIT, PRESENT, STAGE_COUNT };
+  static const std::array<const char *, STAGE_COUNT> stageNames;
+
+  // Histograms hold microseconds; INTERVAL is the start-to-start time between
+  // frames, CPU the sum of all stages.
+  enum Metric { INTERVAL = STAGE_COUNT, CPU, METRIC_COUNT };
+
+  struct Totals {
+    uint64_t frames = 0;
+    uint64_t missedFrames = 0;
+    uint64_t droppedSamples = 0;
+    std::array<LatencyHistogram, METRIC_COUNT> histograms;
+  };
+
+  FrameStats();
+  ~FrameStats();
+
+  FrameStats(const FrameStats &) = delete;
+  FrameStats &operator=(const FrameStats &) = delete;
+
+  // Frames whose interval exceeds the budget are counted as missed.
+  void setFrameBudget(std::chrono::microseconds budget);
+
+  // Render thread only.
+  void beginFrame();
+  void endStage(Stage stage);
+  void endFrame();
+
+  void startReporter(std::ostream &out, std::chrono::milliseconds period);
+  void stopReporter();
+
+  // Drains anything still queued and returns the statistics since startup.
+  // Safe to call while the reporter runs.
+  Totals getTotals();
+  // Forgets everything recorded so far, e.g. to discard warmup frames.
+  void reset();
+  void writeSummary(std::ostream &out, const char *label,
+                    const Totals &totals, double seconds) const;
+
+private:
+  static constexpr size_t RING_SIZE = 1024;
+  static constexpr size_t FIELD_COUNT = STAGE_COUNT + 2;
+
+  using Clock = std::chrono::steady_clock;
+
+  // Fields are relaxed atomics so a reader racing a wrapped-around writer
+  // sees stale or torn values instead of undefined behaviour; such samples
+  // are detected and discarded by re-checking the write index afterwards.
+  struct Slot {
+    std::array<std::atomic<uint32_t>, FIELD_COUNT> fields;
+  };
+
+  std::vector<Slot> ring;
+  std::atomic<uint64_t> writeIndex{0};
+
+  // Producer state.
+  Clock::time_point frameStart;
+  Clock::time_point lastMark;
+  Clock::time_point previousFrameStart;
+  bool hasPreviousFrame = false;
+  std::array<uint32_t, FIELD_COUNT> current{};
+
+  // Consumer state, guarded by consumerMutex.
+  std::mutex consumerMutex;
+  uint64_t readIndex = 0;
+  uint32_t budgetUs = 16667;
+  Totals totals;
+  Totals window;
+
+  std::thread reporter;
+  std::mutex reporterMutex;
+  std::condition_variable reporterWake;
+  bool stopRequested = false;
+
+  void drain();
+  void reporterLoop(std::ostream &out, std::chrono::milliseconds period);
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+
+// What the renderer draws every frame. Each draw emits trianglesPerDraw
+// triangles for each of instanceCount instances; consecutive draws cycle
+// through pipelineCount pipelines.
+struct Scene {
+  // INTERLEAVED binds one stream of {position, color} vertices, SPLIT binds
+  // positions and colors as two separate streams.
+  enum VertexLayout { INTERLEAVED, SPLIT };
+
+  uint32_t drawCount = 1;
+  uint32_t trianglesPerDraw = 1;
+  uint32_t pipelineCount = 1;
+  VertexLayout vertexLayout = INTERLEAVED;
+  uint32_t instanceCount = 1;
+};
+
+#endif
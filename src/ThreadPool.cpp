@@ -0,0 +1,65 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+  workers.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++) {
+    workers.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(const std::function<void(uint32_t worker)> &task) {
+  std::unique_lock<std::mutex> lock(mutex);
+  currentTask = &task;
+  pending = getThreadCount();
+  failure = nullptr;
+  generation++;
+  wake.notify_all();
+
+  done.wait(lock, [this] { return pending == 0; });
+  currentTask = nullptr;
+
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+}
+
+void ThreadPool::workerLoop(uint32_t worker) {
+  uint64_t seenGeneration = 0;
+
+  while (true) {
+    const std::function<void(uint32_t)> *task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+      if (stopping) return;
+      seenGeneration = generation;
+      task = currentTask;
+    }
+
+    std::exception_ptr error;
+    try {
+      (*task)(worker);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error && !failure) {
+      failure = error;
+    }
+    if (--pending == 0) {
+      done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that all run the same task and are joined
+// before run() returns, which is exactly the fork/join shape of recording one
+// slice of a frame per worker. Workers sleep between runs.
+class ThreadPool {
+public:
+  explicit ThreadPool(uint32_t threadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+  // Calls task(worker) once on every worker and blocks until all of them
+  // have returned. The first exception thrown by a task is rethrown here.
+  void run(const std::function<void(uint32_t worker)> &task);
+
+private:
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(uint32_t)> *currentTask = nullptr;
+  uint64_t generation = 0;
+  uint32_t pending = 0;
+  std::exception_ptr failure;
+  bool stopping = false;
+
+  void workerLoop(uint32_t worker);
+};
+
+#endif
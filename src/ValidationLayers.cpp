@@ -83,19 +83,20 @@ void ValidationLayers::populateMessengerCreateInfo(
   createInfo.pUserData = nullptr;
 }
 
-void ValidationLayers::setup(VkInstance instance) {
-  if (!enable) return;
-
+void ValidationLayers::setup(VkInstance instance,
+                             const VkAllocationCallbacks *allocator) {
   VkDebugUtilsMessengerCreateInfoEXT createInfo;
   populateMessengerCreateInfo(createInfo);
 
-  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr,
+  if (CreateDebugUtilsMessengerEXT(instance, &createInfo, allocator,
                                    &messenger) != VK_SUCCESS) {
     throw std::runtime_error("failed to set up debug messenger!");
   }
 }
 
-void ValidationLayers::cleanup(VkInstance instance) {
-  if (!enable) return;
-  DestroyDebugUtilsMessengerEXT(instance, messenger, nullptr);
+void ValidationLayers::cleanup(VkInstance instance,
+                               const VkAllocationCallbacks *allocator) {
+  if (messenger == VK_NULL_HANDLE) return;
+  DestroyDebugUtilsMessengerEXT(instance, messenger, allocator);
+  messenger = VK_NULL_HANDLE;
 }
@@ -18,8 +18,9 @@ public:
   static void populateMessengerCreateInfo(
       VkDebugUtilsMessengerCreateInfoEXT &createInfo);
 
-  void setup(VkInstance instance);
-  void cleanup(VkInstance instance);
+  // allocator must be the one the instance was created with.
+  void setup(VkInstance instance, const VkAllocationCallbacks *allocator);
+  void cleanup(VkInstance instance, const VkAllocationCallbacks *allocator);
 
 private:
   VkDebugUtilsMessengerEXT messenger = VK_NULL_HANDLE;
@@ -0,0 +1,289 @@
+#include "VulkanCullingPass.h"
+#include "VulkanDevice.h"
+#include "shaders/cull_comp.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+VulkanCullingPass::VulkanCullingPass(VulkanDevice &device) : device(device) {}
+
+bool VulkanCullingPass::isSupported() const {
+  if (!device.getEnabledVulkan12Features().drawIndirectCount) {
+    std::cerr << "GPU culling disabled: drawIndirectCount is not supported by this device" << std::endl;
+    return false;
+  }
+  if (!device.getEnabledFeatures().multiDrawIndirect ||
+      !device.getEnabledFeatures().drawIndirectFirstInstance) {
+    std::cerr << "GPU culling disabled: multi-draw indirect with first instance is not supported by this device" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void VulkanCullingPass::create(uint32_t framesInFlight) {
+  if (!device.getConfig().gpuCulling || !isSupported()) {
+    return;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+
+  // Every instance could be visible, but no more commands than the device
+  // accepts in one indirect draw.
+  maxDrawCount = std::min(device.getInstanceBuffer().getInstanceCount(),
+                          properties.limits.maxDrawIndirectCount);
+
+  VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+  commandsOffset = (sizeof(uint32_t) + alignment - 1) & ~(alignment - 1);
+  VkDeviceSize commandsSize =
+      VkDeviceSize(maxDrawCount) * sizeof(VkDrawIndexedIndirectCommand);
+  frameSize = (commandsOffset + commandsSize + alignment - 1) & ~(alignment - 1);
+
+  // Exclusive even with async compute: regions change hands with explicit
+  // ownership transfers instead of paying for concurrent sharing.
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = frameSize * framesInFlight;
+  bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  device.getMemoryAllocator().createBuffer(
+      bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, allocation);
+
+  createDescriptorSet();
+  createPipeline();
+}
+
+void VulkanCullingPass::createDescriptorSet() {
+  VkDescriptorSetLayoutBinding bindings[2]{};
+  for (uint32_t i = 0; i < 2; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(device.getDevice(), &layoutInfo,
+                                  device.getAllocationCallbacks(),
+                                  &descriptorSetLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create culling descriptor set layout!");
+  }
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  poolSize.descriptorCount = 2;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(device.getDevice(), &poolInfo,
+                             device.getAllocationCallbacks(),
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create culling descriptor pool!");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &descriptorSetLayout;
+
+  if (vkAllocateDescriptorSets(device.getDevice(), &allocInfo,
+                               &descriptorSet) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate culling descriptor set!");
+  }
+
+  // Both bindings describe frame 0; the frame's dynamic offset moves them.
+  VkDescriptorBufferInfo bufferInfos[2]{};
+  bufferInfos[0].buffer = buffer;
+  bufferInfos[0].offset = 0;
+  bufferInfos[0].range = sizeof(uint32_t);
+  bufferInfos[1].buffer = buffer;
+  bufferInfos[1].offset = commandsOffset;
+  bufferInfos[1].range = frameSize - commandsOffset;
+
+  VkWriteDescriptorSet descriptorWrites[2]{};
+  for (uint32_t i = 0; i < 2; i++) {
+    descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[i].dstSet = descriptorSet;
+    descriptorWrites[i].dstBinding = i;
+    descriptorWrites[i].dstArrayElement = 0;
+    descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    descriptorWrites[i].descriptorCount = 1;
+    descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+  }
+
+  vkUpdateDescriptorSets(device.getDevice(), 2, descriptorWrites, 0, nullptr);
+}
+
+void VulkanCullingPass::createPipeline() {
+  // Set 0 is the instance buffer's own set, shared with the vertex shader.
+  VkDescriptorSetLayout setLayouts[] = {
+      device.getInstanceBuffer().getDescriptorSetLayout(), descriptorSetLayout};
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(CullConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 2;
+  pipelineLayoutInfo.pSetLayouts = setLayouts;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if (vkCreatePipelineLayout(device.getDevice(), &pipelineLayoutInfo,
+                             device.getAllocationCallbacks(),
+                             &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create culling pipeline layout!");
+  }
+
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = sizeof(shaders::cull_comp);
+  moduleInfo.pCode = shaders::cull_comp;
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device.getDevice(), &moduleInfo,
+                           device.getAllocationCallbacks(),
+                           &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create shader module!");
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  VkResult result = vkCreateComputePipelines(
+      device.getDevice(), device.getPipeLineCache().getCache(), 1,
+      &pipelineInfo, device.getAllocationCallbacks(), &pipeline);
+  vkDestroyShaderModule(device.getDevice(), shaderModule,
+                        device.getAllocationCallbacks());
+
+  if (result != VK_SUCCESS) {
+    pipeline = VK_NULL_HANDLE;
+    throw std::runtime_error("failed to create culling pipeline!");
+  }
+}
+
+void VulkanCullingPass::cleanup() {
+  if (buffer == VK_NULL_HANDLE) return;
+
+  vkDestroyPipeline(device.getDevice(), pipeline,
+                    device.getAllocationCallbacks());
+  vkDestroyPipelineLayout(device.getDevice(), pipelineLayout,
+                          device.getAllocationCallbacks());
+  vkDestroyDescriptorPool(device.getDevice(), descriptorPool,
+                          device.getAllocationCallbacks());
+  vkDestroyDescriptorSetLayout(device.getDevice(), descriptorSetLayout,
+                               device.getAllocationCallbacks());
+  pipeline = VK_NULL_HANDLE;
+  pipelineLayout = VK_NULL_HANDLE;
+  descriptorPool = VK_NULL_HANDLE;
+  descriptorSetLayout = VK_NULL_HANDLE;
+  descriptorSet = VK_NULL_HANDLE;
+
+  device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+  buffer = VK_NULL_HANDLE;
+}
+
+bool VulkanCullingPass::isAsync() const {
+  return device.getQueueScheduler().isAsync(VulkanQueueScheduler::COMPUTE);
+}
+
+void VulkanCullingPass::record(VkCommandBuffer commandBuffer, uint32_t frame) {
+  if (!isAsync()) {
+    recordCulling(commandBuffer, frame);
+
+    VkMemoryBarrier cullBarrier{};
+    cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1,
+                         &cullBarrier, 0, nullptr, 0, nullptr);
+    return;
+  }
+
+  // The frame's last submission has completed, so graphics is done reading the region
+  // from its last use.
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  VkDeviceSize frameOffset = frame * frameSize;
+
+  VkCommandBuffer computeCommands =
+      scheduler.begin(VulkanQueueScheduler::COMPUTE, frame);
+  recordCulling(computeCommands, frame);
+  scheduler.releaseBuffer(computeCommands, VulkanQueueScheduler::COMPUTE,
+                          VulkanQueueScheduler::GRAPHICS, buffer, frameOffset,
+                          frameSize, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                          VK_ACCESS_SHADER_WRITE_BIT);
+  scheduler.submit(VulkanQueueScheduler::COMPUTE, frame,
+                   VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+
+  scheduler.acquireBuffer(commandBuffer, VulkanQueueScheduler::COMPUTE,
+                          VulkanQueueScheduler::GRAPHICS, buffer, frameOffset,
+                          frameSize, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                          VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+}
+
+void VulkanCullingPass::recordCulling(VkCommandBuffer commandBuffer,
+                                      uint32_t frame) {
+  VkDeviceSize frameOffset = frame * frameSize;
+  vkCmdFillBuffer(commandBuffer, buffer, frameOffset, sizeof(uint32_t), 0);
+
+  VkMemoryBarrier clearBarrier{};
+  clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &clearBarrier, 0, nullptr, 0, nullptr);
+
+  const VulkanInstanceBuffer &instanceBuffer = device.getInstanceBuffer();
+  VkDescriptorSet descriptorSets[] = {instanceBuffer.getDescriptorSet(),
+                                      descriptorSet};
+  uint32_t dynamicOffsets[] = {instanceBuffer.getDynamicOffset(frame),
+                               static_cast<uint32_t>(frameOffset),
+                               static_cast<uint32_t>(frameOffset)};
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 2, descriptorSets, 3,
+                          dynamicOffsets);
+
+  CullConstants constants{};
+  constants.instanceCount = instanceBuffer.getInstanceCount();
+  constants.indexCount = device.getMeshBuffer().getIndexCount();
+  constants.maxDrawCount = maxDrawCount;
+  constants.boundingRadius = device.getMeshBuffer().getBoundingRadius();
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                     0, sizeof(constants), &constants);
+
+  vkCmdDispatch(commandBuffer,
+                (constants.instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE,
+                1, 1);
+}
+
+void VulkanCullingPass::draw(VkCommandBuffer commandBuffer,
+                             uint32_t frame) const {
+  VkDeviceSize frameOffset = frame * frameSize;
+  vkCmdDrawIndexedIndirectCount(commandBuffer, buffer,
+                                frameOffset + commandsOffset, buffer,
+                                frameOffset, maxDrawCount,
+                                sizeof(VkDrawIndexedIndirectCommand));
+}
@@ -0,0 +1,86 @@
+#ifndef VULKAN_CULLING_PASS_H
+#define VULKAN_CULLING_PASS_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <vulkan/vulkan.h>
+
+// Moves visibility decisions to the GPU. A compute pass tests every instance's
+// bounding sphere against the view and appends one VkDrawIndexedIndirectCommand
+// per survivor, bumping a draw count as it goes; the graphics pass then draws
+// them with vkCmdDrawIndexedIndirectCount. The CPU records the same handful of
+// commands whatever the number of instances.
+//
+// Each frame in flight owns a region of the output buffer, holding the count
+// followed by the commands, so a frame never overwrites what an earlier one
+// may still be drawing from.
+//
+// When the device has an async compute queue the pass runs there, and the
+// frame's region is handed to graphics with a semaphore and a queue family
+// ownership transfer. Ownership is not handed back: the next cull of the
+// region overwrites it, so its old contents need not survive.
+class VulkanCullingPass {
+public:
+  static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+  // Must match CullConstants in cull.comp.
+  struct CullConstants {
+    uint32_t instanceCount;
+    uint32_t indexCount;
+    uint32_t maxDrawCount;
+    float boundingRadius;
+  };
+
+  VulkanCullingPass(VulkanDevice &device);
+
+  VulkanCullingPass(const VulkanCullingPass &) = delete;
+  VulkanCullingPass &operator=(const VulkanCullingPass &) = delete;
+
+  // Stays disabled, with a message, unless DeviceConfig::gpuCulling is set and
+  // the device supports draw-indirect-count and indirect first instances.
+  void create(uint32_t framesInFlight);
+  void cleanup();
+
+  bool isEnabled() const { return pipeline != VK_NULL_HANDLE; }
+  // True when culling runs on the async compute queue.
+  bool isAsync() const;
+
+  // Resets the frame's count and culls into its region, either directly in
+  // commandBuffer or on the compute queue, leaving only the hand-over in
+  // commandBuffer. Must be recorded outside the render pass, before any
+  // draw().
+  void record(VkCommandBuffer commandBuffer, uint32_t frame);
+  // Only the cull itself, for callers that synchronize with draw() on their
+  // own, like the render graph.
+  void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame);
+  // Draws what record() left for the frame, with whatever pipeline, vertex
+  // buffers and descriptor sets are bound.
+  void draw(VkCommandBuffer commandBuffer, uint32_t frame) const;
+
+  VkBuffer getBuffer() const { return buffer; }
+  VkDeviceSize getFrameOffset(uint32_t frame) const { return frame * frameSize; }
+  VkDeviceSize getFrameSize() const { return frameSize; }
+
+private:
+  VulkanDevice &device;
+
+  uint32_t maxDrawCount = 0;
+  // Offset of the commands from the start of a frame's region; the count
+  // sits at the start.
+  VkDeviceSize commandsOffset = 0;
+  VkDeviceSize frameSize = 0;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VulkanAllocation allocation;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  bool isSupported() const;
+  void createDescriptorSet();
+  void createPipeline();
+};
+
+#endif
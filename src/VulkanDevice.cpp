@@ -2,55 +2,112 @@
 #include "ValidationLayers.h"
 #include "VulkanSwapChain.h"
 #include "Window.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
 #include <stdexcept>
 #include <cstdint>
 
-VulkanDevice::VulkanDevice(Window &window)
-    : window(window), instance(VK_NULL_HANDLE), vulkanSwapChain(*this), vulkanPipeLine(*this), vulkanRenderer(*this) {
+VulkanDevice::VulkanDevice(Window &window, const DeviceConfig &config)
+    : VulkanDevice(&window, VkExtent2D{0, 0}, config) {}
+
+VulkanDevice::VulkanDevice(VkExtent2D offscreenExtent,
+                           const DeviceConfig &config)
+    : VulkanDevice(nullptr, offscreenExtent, config) {}
+
+VulkanDevice::VulkanDevice(Window *window, VkExtent2D offscreenExtent,
+                           const DeviceConfig &config)
+    : window(window), offscreenExtent(offscreenExtent), config(config), instance(VK_NULL_HANDLE), vulkanMemoryAllocator(*this), vulkanQueueScheduler(*this), vulkanPipeLineCache(*this), vulkanPipeLineManager(*this), vulkanStagingRing(*this), vulkanMeshBuffer(*this), vulkanUniformRing(*this), vulkanInstanceBuffer(*this), vulkanCullingPass(*this), vulkanSwapChain(*this), vulkanFrameCapture(*this), vulkanPipeLine(*this), vulkanRenderer(*this, config.framesInFlight), vulkanProfiler(*this) {
+  if (!isHeadless()) {
+    deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
   initVulkan();
 }
 
 VulkanDevice::~VulkanDevice() {
+  // The device is idle by now. What swap chain recreation retired still
+  // needs the objects it came from, like the renderer's command pool.
+  vulkanQueueScheduler.collectGarbage();
+  vulkanProfiler.cleanup();
   vulkanRenderer.cleanup();
+  vulkanFrameCapture.cleanup();
+  // Before the layout goes away and the cache is saved, so compiles still
+  // running finish into it.
+  vulkanPipeLineManager.cleanup();
   vulkanPipeLine.cleanup();
   vulkanSwapChain.cleanup();
+  vulkanCullingPass.cleanup();
+  vulkanInstanceBuffer.cleanup();
+  vulkanUniformRing.cleanup();
+  vulkanMeshBuffer.cleanup();
+  vulkanStagingRing.cleanup();
+  vulkanPipeLineCache.cleanup();
+  vulkanQueueScheduler.cleanup();
+  vulkanMemoryAllocator.cleanup();
 
-  vkDestroyDevice(device, nullptr);
+  vkDestroyDevice(device, hostAllocator.getCallbacks());
 
-  validationLayers.cleanup(instance);
+  validationLayers.cleanup(instance, hostAllocator.getCallbacks());
 
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface, hostAllocator.getCallbacks());
+  }
 
   if (instance != VK_NULL_HANDLE) {
-    vkDestroyInstance(instance, nullptr);
+    vkDestroyInstance(instance, hostAllocator.getCallbacks());
   }
 }
 
 void VulkanDevice::initVulkan() {
   createInstance();
-  validationLayers.setup(instance);
+  if (config.validation) {
+    validationLayers.setup(instance, hostAllocator.getCallbacks());
+  }
   createSurface();
   pickPhysicalDevice();
   createLogicalDevice();
+  vulkanMemoryAllocator.create();
+  vulkanQueueScheduler.create(vulkanRenderer.getFramesInFlight());
+  vulkanPipeLineCache.create(config.pipelineCachePath);
+  vulkanPipeLineManager.create(config.pipelineThreads);
+
+  vulkanStagingRing.create();
+  vulkanMeshBuffer.create();
+  vulkanUniformRing.create(vulkanRenderer.getFramesInFlight());
+  vulkanInstanceBuffer.create(config.scene.instanceCount,
+                              vulkanRenderer.getFramesInFlight());
+  vulkanCullingPass.create(vulkanRenderer.getFramesInFlight());
 
   vulkanSwapChain.createSwapChain();
   vulkanSwapChain.createImageViews();
+  vulkanFrameCapture.create(vulkanRenderer.getFramesInFlight());
 
   vulkanPipeLine.createRenderPass();
   vulkanPipeLine.createGraphicsPipeline();
 
   vulkanRenderer.createFramebuffers();
   vulkanRenderer.createCommandPool();
-  vulkanRenderer.createCommandBuffer();
+  vulkanRenderer.createCommandBuffers();
+  if (config.cacheCommandBuffers) {
+    vulkanRenderer.createCachedCommandBuffers();
+  } else if (config.recordThreads > 0) {
+    vulkanRenderer.createWorkerCommandPools(config.recordThreads);
+  }
   vulkanRenderer.createSyncObjects();
+
+  if (config.gpuProfiling) {
+    vulkanProfiler.create(vulkanRenderer.getFramesInFlight(),
+                          config.pipelineStatistics);
+  }
 }
 
 void VulkanDevice::createInstance() {
-  if (ValidationLayers::enable && !ValidationLayers::checkSupport()) {
+  if (config.validation && !ValidationLayers::checkSupport()) {
     throw std::runtime_error("Validation layers requested, but not available!");
   }
 
@@ -72,46 +129,70 @@ void VulkanDevice::createInstance() {
   vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount,
                                          extensions.data());
 
-  std::cout << "Available extensions:\n";
-  for (const auto &extension : extensions) {
-    std::cout << '\t' << extension.extensionName << '\n';
-  }
-
   auto requiredExtensions = getRequiredExtensions();
 
-  std::cout << "\nRequired GLFW extensions:\n";
-  for (const auto &ext : requiredExtensions) {
-    std::cout << '\t' << ext << '\n';
+  if (config.verbose) {
+    std::cout << "Available extensions:\n";
+    for (const auto &extension : extensions) {
+      std::cout << '\t' << extension.extensionName << '\n';
+    }
+
+    std::cout << "\nRequired instance extensions:\n";
+    for (const auto &ext : requiredExtensions) {
+      std::cout << '\t' << ext << '\n';
+    }
   }
 
   if (!checkExtensionSupport(requiredExtensions.data(),
                              static_cast<uint32_t>(requiredExtensions.size()),
                              extensions)) {
-    throw std::runtime_error("Required GLFW extensions are not supported!");
+    throw std::runtime_error("Required instance extensions are not supported!");
+  }
+  if (config.verbose) {
+    std::cout << "\nAll required extensions are supported!\n" << std::endl;
+  }
+
+  // Lets the device report when presentation is done with a swap chain,
+  // see createLogicalDevice().
+  const char *surfaceMaintenanceExtensions[] = {
+      VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME,
+      VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME};
+  if (!isHeadless() &&
+      checkExtensionSupport(surfaceMaintenanceExtensions, 2, extensions)) {
+    requiredExtensions.insert(requiredExtensions.end(),
+                              surfaceMaintenanceExtensions,
+                              surfaceMaintenanceExtensions + 2);
+    surfaceMaintenanceEnabled = true;
   }
-  std::cout << "\nAll required extensions are supported!\n" << std::endl;
 
   createInfo.enabledExtensionCount =
       static_cast<uint32_t>(requiredExtensions.size());
   createInfo.ppEnabledExtensionNames = requiredExtensions.data();
 
-  if (ValidationLayers::enable) {
+  if (config.validation) {
     createInfo.enabledLayerCount =
         static_cast<uint32_t>(ValidationLayers::validationLayers.size());
     createInfo.ppEnabledLayerNames = ValidationLayers::validationLayers.data();
-    std::cout << "Validation layers enabled\n" << std::endl;
   } else {
     createInfo.enabledLayerCount = 0;
-    std::cout << "Validation layers disabled\n" << std::endl;
+  }
+  if (config.verbose) {
+    std::cout << (config.validation ? "Validation layers enabled\n"
+                                    : "Validation layers disabled\n")
+              << std::endl;
   }
 
-  if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+  if (vkCreateInstance(&createInfo,
+                       hostAllocator.getCallbacks(), &instance) != VK_SUCCESS) {
     throw std::runtime_error("Failed to create Vulkan instance!");
   }
 }
 
 void VulkanDevice::createSurface() {
-  if (glfwCreateWindowSurface(instance, window.getGLFWWindow(), nullptr,
+  if (isHeadless()) return;
+
+  if (glfwCreateWindowSurface(instance, window->getGLFWWindow(),
+                              hostAllocator.getCallbacks(),
                               &surface) != VK_SUCCESS) {
     throw std::runtime_error("failed to create window surface!");
   }
@@ -128,60 +209,276 @@ void VulkanDevice::pickPhysicalDevice() {
   std::vector<VkPhysicalDevice> devices(deviceCount);
   vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
+  std::string requested = config.device;
+  if (requested.empty()) {
+    const char *env = std::getenv("TRIANGLE_DEVICE");
+    requested = env != nullptr ? env : "";
+  }
+
+  // An explicit choice wins, but must still be able to run the renderer. A
+  // name may match several devices, like two cards of the same model; the
+  // best of them that can run it is used.
+  if (!requested.empty()) {
+    VkPhysicalDevice best = VK_NULL_HANDLE;
+    int bestScore = 0;
+    bool matched = false;
+    for (const auto &device : devices) {
+      if (!matchesDevice(device, requested)) continue;
+      matched = true;
+      int score = rateDeviceSuitability(device);
+      if (score > bestScore) {
+        best = device;
+        bestScore = score;
+      }
+    }
+    if (!matched) {
+      throw std::runtime_error("no GPU matches '" + requested + "'!");
+    }
+    if (best == VK_NULL_HANDLE) {
+      throw std::runtime_error("no GPU matching '" + requested +
+                               "' can run this renderer!");
+    }
+    selectPhysicalDevice(best, bestScore, "requested");
+    return;
+  }
+
+  // Properties are cheap; the cached device only has to pass its own
+  // suitability check instead of probing every candidate.
+  std::string cachedUuid;
+  uint32_t cachedDriverVersion = 0;
+  if (loadDeviceChoice(cachedUuid, cachedDriverVersion)) {
+    for (const auto &device : devices) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(device, &properties);
+      if (deviceUuid(device) != cachedUuid ||
+          properties.driverVersion != cachedDriverVersion) {
+        continue;
+      }
+      int score = rateDeviceSuitability(device);
+      if (score > 0) {
+        selectPhysicalDevice(device, score, "cached");
+        return;
+      }
+    }
+  }
+
   std::multimap<int, VkPhysicalDevice> candidates;
 
   for (const auto &device : devices) {
     int score = rateDeviceSuitability(device);
     candidates.insert(std::make_pair(score, device));
+
+    if (config.verbose) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(device, &properties);
+      std::cout << "GPU " << properties.deviceName << " ("
+                << deviceUuid(device) << "): score " << score << std::endl;
+    }
   }
 
   if (candidates.rbegin()->first > 0) {
-    physicalDevice = candidates.rbegin()->second;
+    selectPhysicalDevice(candidates.rbegin()->second,
+                         candidates.rbegin()->first, "best score");
+    saveDeviceChoice();
   } else {
     throw std::runtime_error("failed to find a suitable GPU!");
   }
 }
 
+void VulkanDevice::selectPhysicalDevice(VkPhysicalDevice device, int score,
+                                        const char *reason) {
+  physicalDevice = device;
+  // Everything created later asks for the families of the selected device.
+  selectedQueueFamilies = findQueueFamilies(device);
+
+  if (config.verbose) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    std::cout << "Using GPU " << properties.deviceName << " (" << reason
+              << ", score " << score << ")" << std::endl;
+  }
+}
+
 int VulkanDevice::rateDeviceSuitability(VkPhysicalDevice device) {
   VkPhysicalDeviceProperties deviceProperties;
-  VkPhysicalDeviceFeatures deviceFeatures;
   vkGetPhysicalDeviceProperties(device, &deviceProperties);
-  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-
-  int score = 0;
 
-  if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-    score += 1000;
+  // Synchronization is built on timeline semaphores, core and mandatory
+  // since Vulkan 1.2.
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_2) {
+    return 0;
   }
-
-  score += deviceProperties.limits.maxImageDimension2D;
-
-  if (!deviceFeatures.geometryShader) {
+  bool vulkan13 = deviceProperties.apiVersion >= VK_API_VERSION_1_3;
+
+  VkPhysicalDeviceVulkan13Features vulkan13Features{};
+  vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  VkPhysicalDeviceVulkan12Features vulkan12Features{};
+  vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  vulkan12Features.pNext = vulkan13 ? &vulkan13Features : nullptr;
+  VkPhysicalDeviceFeatures2 deviceFeatures{};
+  deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  deviceFeatures.pNext = &vulkan12Features;
+  vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
+
+  if (!vulkan12Features.timelineSemaphore ||
+      !checkDeviceExtensionSupport(device)) {
     return 0;
   }
 
+  // Queue family and surface queries only for devices that got this far.
   QueueFamilyIndices indices = findQueueFamilies(device);
+  if (!indices.isComplete()) {
+    return 0;
+  }
 
-  bool extensionsSupported = checkDeviceExtensionSupport(device);
-  bool swapChainAdequate = false;
-
-  if (extensionsSupported) {
+  if (!isHeadless()) {
     uint32_t formatCount = 0;
     vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
 
     uint32_t presentModeCount = 0;
     vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
 
-    swapChainAdequate = formatCount > 0 && presentModeCount > 0;
+    if (formatCount == 0 || presentModeCount == 0) {
+      return 0;
+    }
   }
 
-  if (!indices.isComplete() || !extensionsSupported || !swapChainAdequate) {
-    return 0;
+  // Past this point the device works; the rest only ranks it. Device type
+  // dominates, so software rasterizers like llvmpipe are picked last but
+  // still picked.
+  int score = 1;
+  switch (deviceProperties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    score += 10000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    score += 5000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    score += 2000;
+    break;
+  default:
+    break;
+  }
+
+  // Largest DEVICE_LOCAL heap, a point per 16 MiB up to 2000.
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+  VkDeviceSize localHeap = 0;
+  for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+    if (memoryProperties.memoryHeaps[heap].flags &
+        VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      localHeap = std::max(localHeap, memoryProperties.memoryHeaps[heap].size);
+    }
+  }
+  score += static_cast<int>(
+      std::min<VkDeviceSize>(localHeap / (16 * 1024 * 1024), 2000));
+
+  // Dedicated families let VulkanQueueScheduler overlap uploads and culling
+  // with rendering.
+  if (indices.transferFamily != indices.graphicsFamily) {
+    score += 250;
+  }
+  if (indices.computeFamily != indices.graphicsFamily) {
+    score += 250;
+  }
+
+  // Optional paths the config asks for; without them the renderer falls
+  // back to slower ones.
+  const VkPhysicalDeviceFeatures &features = deviceFeatures.features;
+  if (config.gpuCulling && features.multiDrawIndirect &&
+      features.drawIndirectFirstInstance &&
+      vulkan12Features.drawIndirectCount) {
+    score += 500;
+  }
+  if (config.dynamicRendering && vulkan13Features.dynamicRendering &&
+      vulkan13Features.synchronization2) {
+    score += 500;
+  }
+  if (config.pipelineStatistics && features.pipelineStatisticsQuery) {
+    score += 100;
+  }
+  if (supportsDeviceExtension(device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    score += 100;
   }
 
   return score;
 }
 
+std::string VulkanDevice::deviceUuid(VkPhysicalDevice device) {
+  VkPhysicalDeviceIDProperties idProperties{};
+  idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &idProperties;
+  vkGetPhysicalDeviceProperties2(device, &properties);
+
+  static const char digits[] = "0123456789abcdef";
+  std::string uuid;
+  for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+    uuid += digits[idProperties.deviceUUID[i] >> 4];
+    uuid += digits[idProperties.deviceUUID[i] & 0xf];
+  }
+  return uuid;
+}
+
+bool VulkanDevice::matchesDevice(VkPhysicalDevice device,
+                                 const std::string &requested) {
+  auto lower = [](std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](char c) {
+      return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    });
+    return text;
+  };
+
+  // UUIDs may be written with or without dashes.
+  std::string uuid = lower(requested);
+  uuid.erase(std::remove(uuid.begin(), uuid.end(), '-'), uuid.end());
+  if (uuid == deviceUuid(device)) {
+    return true;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+  return lower(properties.deviceName).find(lower(requested)) !=
+         std::string::npos;
+}
+
+bool VulkanDevice::loadDeviceChoice(std::string &uuid,
+                                    uint32_t &driverVersion) {
+  if (config.deviceCachePath.empty()) return false;
+
+  std::ifstream file(config.deviceCachePath);
+  std::string requirements;
+  if (!(file >> uuid >> driverVersion >> requirements)) {
+    return false;
+  }
+  // A choice made for different requirements may no longer be the best.
+  return requirements == deviceRequirements();
+}
+
+void VulkanDevice::saveDeviceChoice() {
+  if (config.deviceCachePath.empty()) return;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  // Not worth failing over: the next start just probes again.
+  std::ofstream file(config.deviceCachePath, std::ios::trunc);
+  file << deviceUuid(physicalDevice) << " " << properties.driverVersion << " "
+       << deviceRequirements() << "\n";
+}
+
+std::string VulkanDevice::deviceRequirements() const {
+  // Everything in the config that changes how devices are scored.
+  std::string requirements;
+  requirements += isHeadless() ? 'h' : 'w';
+  requirements += config.gpuCulling ? 'c' : '-';
+  requirements += config.dynamicRendering ? 'd' : '-';
+  requirements += config.pipelineStatistics ? 's' : '-';
+  return requirements;
+}
+
 bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
@@ -201,8 +498,31 @@ bool VulkanDevice::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   return requiredExtensions.empty();
 }
 
+bool VulkanDevice::supportsDeviceExtension(VkPhysicalDevice device,
+                                           const char *name) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 VulkanDevice::QueueFamilyIndices
 VulkanDevice::findQueueFamilies(VkPhysicalDevice device) {
+  // Asked for on every buffer creation; the answer never changes.
+  if (device == physicalDevice && selectedQueueFamilies.has_value()) {
+    return *selectedQueueFamilies;
+  }
+
   QueueFamilyIndices indices;
 
   uint32_t queueFamilyCount = 0;
@@ -218,8 +538,14 @@ VulkanDevice::findQueueFamilies(VkPhysicalDevice device) {
       indices.graphicsFamily = i;
     }
 
+    // Without a surface, finished offscreen images are handed back on the
+    // graphics queue, so any graphics family doubles as the present family.
     VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+    if (isHeadless()) {
+      presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+    } else {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+    }
     if (presentSupport) {
       indices.presentFamily = i;
     }
@@ -231,6 +557,33 @@ VulkanDevice::findQueueFamilies(VkPhysicalDevice device) {
     i++;
   }
 
+  // A transfer-only family usually maps to a DMA engine that can stream
+  // uploads without occupying the graphics queue; otherwise share graphics.
+  for (uint32_t family = 0; family < queueFamilyCount; family++) {
+    VkQueueFlags flags = queueFamilies[family].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      indices.transferFamily = family;
+      break;
+    }
+  }
+  if (!indices.transferFamily.has_value()) {
+    indices.transferFamily = indices.graphicsFamily;
+  }
+
+  // Likewise a compute family without graphics is an async compute engine
+  // that runs alongside the graphics queue.
+  for (uint32_t family = 0; family < queueFamilyCount; family++) {
+    VkQueueFlags flags = queueFamilies[family].queueFlags;
+    if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      indices.computeFamily = family;
+      break;
+    }
+  }
+  if (!indices.computeFamily.has_value()) {
+    indices.computeFamily = indices.graphicsFamily;
+  }
+
   return indices;
 }
 
@@ -240,7 +593,9 @@ void VulkanDevice::createLogicalDevice() {
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                            indices.presentFamily.value()};
+                                            indices.presentFamily.value(),
+                                            indices.transferFamily.value(),
+                                            indices.computeFamily.value()};
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -252,19 +607,111 @@ void VulkanDevice::createLogicalDevice() {
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
   VkPhysicalDeviceFeatures deviceFeatures{};
+  deviceFeatures.pipelineStatisticsQuery =
+      config.pipelineStatistics && supportedFeatures.pipelineStatisticsQuery;
+  // Statistics queries stay active while secondary command buffers execute.
+  deviceFeatures.inheritedQueries = deviceFeatures.pipelineStatisticsQuery &&
+                                    (config.recordThreads > 0 ||
+                                     config.cacheCommandBuffers) &&
+                                    supportedFeatures.inheritedQueries;
+
+  // pickPhysicalDevice only accepts Vulkan 1.2 devices; 1.3 features can
+  // only be queried and chained on 1.3 devices.
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  bool vulkan13 = properties.apiVersion >= VK_API_VERSION_1_3;
+
+  VkPhysicalDeviceVulkan13Features supportedVulkan13Features{};
+  supportedVulkan13Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+  supportedVulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  supportedVulkan12Features.pNext = vulkan13 ? &supportedVulkan13Features : nullptr;
+  VkPhysicalDeviceFeatures2 supportedFeatures2{};
+  supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supportedFeatures2.pNext = &supportedVulkan12Features;
+  // Only chained when the extension is there to be asked about.
+  bool swapchainMaintenance =
+      surfaceMaintenanceEnabled &&
+      supportsDeviceExtension(physicalDevice,
+                              VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+  VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT
+      supportedSwapchainMaintenanceFeatures{};
+  supportedSwapchainMaintenanceFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+  if (swapchainMaintenance) {
+    supportedSwapchainMaintenanceFeatures.pNext = supportedFeatures2.pNext;
+    supportedFeatures2.pNext = &supportedSwapchainMaintenanceFeatures;
+  }
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+
+  VkPhysicalDeviceVulkan12Features vulkan12Features{};
+  vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  // Frame pacing and cross-queue hand-over, see VulkanQueueScheduler.
+  vulkan12Features.timelineSemaphore = VK_TRUE;
+
+  // GPU culling emits one indirect command per visible instance, carrying
+  // the instance index in firstInstance, and draws them with an indirect
+  // count. VulkanCullingPass reports what is missing.
+  if (config.gpuCulling && supportedVulkan12Features.drawIndirectCount &&
+      supportedFeatures.multiDrawIndirect &&
+      supportedFeatures.drawIndirectFirstInstance) {
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    vulkan12Features.drawIndirectCount = VK_TRUE;
+  }
+
+  VkPhysicalDeviceVulkan13Features vulkan13Features{};
+  vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+  if (config.dynamicRendering && supportedVulkan13Features.dynamicRendering &&
+      supportedVulkan13Features.synchronization2) {
+    vulkan13Features.dynamicRendering = VK_TRUE;
+    vulkan13Features.synchronization2 = VK_TRUE;
+  } else if (config.dynamicRendering) {
+    std::cerr << "Dynamic rendering is not supported by this device, using render passes" << std::endl;
+  }
+  vulkan12Features.pNext = vulkan13 ? &vulkan13Features : nullptr;
+
+  // Real heap budgets for VulkanMemoryAllocator; it estimates them without.
+  if (supportsDeviceExtension(physicalDevice,
+                              VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    memoryBudgetEnabled = true;
+  }
+
+  // Present fences, so the renderer frees what a present waits on once the
+  // present is done rather than when the frame before it finished.
+  VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT
+      swapchainMaintenanceFeatures{};
+  swapchainMaintenanceFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+  swapchainMaintenanceFeatures.pNext = &vulkan12Features;
+  if (swapchainMaintenance &&
+      supportedSwapchainMaintenanceFeatures.swapchainMaintenance1) {
+    deviceExtensions.push_back(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+    swapchainMaintenanceFeatures.swapchainMaintenance1 = VK_TRUE;
+    presentFencesEnabled = true;
+  }
 
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
+  createInfo.pNext = presentFencesEnabled
+                         ? static_cast<void *>(&swapchainMaintenanceFeatures)
+                         : static_cast<void *>(&vulkan12Features);
   createInfo.pEnabledFeatures = &deviceFeatures;
   createInfo.enabledExtensionCount =
       static_cast<uint32_t>(deviceExtensions.size());
   createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
-  if (ValidationLayers::enable) {
+  if (config.validation) {
     createInfo.enabledLayerCount =
         static_cast<uint32_t>(ValidationLayers::validationLayers.size());
     createInfo.ppEnabledLayerNames = ValidationLayers::validationLayers.data();
@@ -272,24 +719,84 @@ void VulkanDevice::createLogicalDevice() {
     createInfo.enabledLayerCount = 0;
   }
 
-  if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
+  if (vkCreateDevice(physicalDevice, &createInfo,
+                     hostAllocator.getCallbacks(), &device) !=
       VK_SUCCESS) {
     throw std::runtime_error("failed to create logical device!");
   }
+  enabledFeatures = deviceFeatures;
+  enabledVulkan12Features = vulkan12Features;
+  enabledVulkan12Features.pNext = nullptr;
+  enabledVulkan13Features = vulkan13Features;
+  enabledVulkan13Features.pNext = nullptr;
 
   vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+  vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
+}
+
+uint32_t VulkanDevice::findMemoryType(uint32_t typeFilter,
+                                      VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+    if ((typeFilter & (1 << i)) &&
+        (memProperties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("failed to find suitable memory type!");
+}
+
+void VulkanDevice::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                VkMemoryPropertyFlags properties,
+                                VkBuffer &buffer, VulkanAllocation &allocation) {
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  // Buffers filled on a separate transfer family are read by graphics
+  // afterwards, and storage buffers may be read by async compute as well, so
+  // they are shared between the families involved. Buffers that should move
+  // between families with ownership transfers instead are created through
+  // the memory allocator directly.
+  QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+  std::vector<uint32_t> queueFamilyIndices = {indices.graphicsFamily.value()};
+  if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) &&
+      indices.transferFamily != indices.graphicsFamily) {
+    queueFamilyIndices.push_back(indices.transferFamily.value());
+  }
+  if ((usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) && config.asyncQueues &&
+      indices.computeFamily != indices.graphicsFamily) {
+    queueFamilyIndices.push_back(indices.computeFamily.value());
+  }
+  if (queueFamilyIndices.size() > 1) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount =
+        static_cast<uint32_t>(queueFamilyIndices.size());
+    bufferInfo.pQueueFamilyIndices = queueFamilyIndices.data();
+  }
+
+  vulkanMemoryAllocator.createBuffer(bufferInfo, properties, buffer, allocation);
 }
 
 std::vector<const char *> VulkanDevice::getRequiredExtensions() {
-  uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions =
-      glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  std::vector<const char *> extensions;
 
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionCount);
+  if (!isHeadless()) {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions =
+        glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
 
-  if (ValidationLayers::enable) {
+  if (config.validation) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
   }
 
@@ -9,27 +9,96 @@
 #include "ValidationLayers.h"
 #include "VulkanSwapChain.h"
 #include "VulkanPipeLine.h"
+#include "VulkanPipeLineCache.h"
+#include "VulkanPipeLineManager.h"
+#include "VulkanMemoryAllocator.h"
+#include "VulkanProfiler.h"
+#include "VulkanStagingRing.h"
+#include "VulkanMeshBuffer.h"
+#include "VulkanUniformRing.h"
+#include "VulkanInstanceBuffer.h"
+#include "VulkanCullingPass.h"
+#include "VulkanFrameCapture.h"
+#include "VulkanHostAllocator.h"
+#include "VulkanQueueScheduler.h"
 #include "VulkanRenderer.h"
+#include "Scene.h"
 
 
 
 class Window;
 
+struct DeviceConfig {
+  uint32_t framesInFlight = VulkanRenderer::DEFAULT_FRAMES_IN_FLIGHT;
+  // GPU to use: a case-insensitive part of its name, or its UUID. Falls back
+  // to the TRIANGLE_DEVICE environment variable, then to the best scoring
+  // device.
+  std::string device;
+  // Where the automatic choice is remembered, so later starts skip probing
+  // every device; empty disables it.
+  std::string deviceCachePath = "device_cache.txt";
+  // Where the pipeline cache is loaded from and saved to; empty disables it.
+  std::string pipelineCachePath = "pipeline_cache.bin";
+  // Threads compiling pipeline variants in the background, see
+  // VulkanPipeLineManager; 0 compiles all of them while starting up.
+  uint32_t pipelineThreads = 2;
+  // Timestamp queries around the recorded passes, see VulkanProfiler.
+  bool gpuProfiling = false;
+  bool pipelineStatistics = false;
+  // Threads recording secondary command buffers; 0 records inline on the
+  // render thread.
+  uint32_t recordThreads = 0;
+  // Replay draws recorded once instead of recording them every frame; takes
+  // precedence over recordThreads.
+  bool cacheCommandBuffers = false;
+  // Cull instances in a compute pass and draw the survivors indirectly, see
+  // VulkanCullingPass.
+  bool gpuCulling = false;
+  // Run compute and transfer work on dedicated queues when the device has
+  // them, see VulkanQueueScheduler.
+  bool asyncQueues = true;
+  // Render with vkCmdBeginRendering and synchronization2 barriers instead of
+  // a VkRenderPass and per-image VkFramebuffers, where Vulkan 1.3 allows it.
+  bool dynamicRendering = false;
+  // Streams every rendered frame to this path, "-" being stdout, see
+  // VulkanFrameCapture; empty disables capture.
+  std::string capturePath;
+  VulkanFrameCapture::Format captureFormat = VulkanFrameCapture::RAW_RGBA;
+  // Frame rate written into Y4M headers.
+  uint32_t captureFps = 60;
+  bool validation = ValidationLayers::enable;
+  // Lists instance extensions and layers while starting up.
+  bool verbose = true;
+  Scene scene;
+};
+
 class VulkanDevice {
 public:
   struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // Dedicated transfer family when the device has one, else graphics.
+    std::optional<uint32_t> transferFamily;
+    // Compute family without graphics when the device has one, else graphics.
+    std::optional<uint32_t> computeFamily;
 
     bool isComplete(){
       return graphicsFamily.has_value() && presentFamily.has_value();
     }
   };
 
-  VulkanDevice(Window &window);
+  VulkanDevice(Window &window, const DeviceConfig &config = DeviceConfig());
+  // Headless device: renders into offscreen images of the given extent, with
+  // no window, surface or swap chain extension involved.
+  VulkanDevice(VkExtent2D offscreenExtent,
+               const DeviceConfig &config = DeviceConfig());
   ~VulkanDevice();
 
   QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
+  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    VulkanAllocation &allocation);
 
   VulkanDevice(const VulkanDevice &) = delete;
   VulkanDevice &operator=(const VulkanDevice &) = delete;
@@ -38,30 +107,95 @@ public:
   VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
   VkDevice getDevice() const { return device; }
   VkQueue getGraphicsQueue() const { return graphicsQueue; }
+  VkQueue getTransferQueue() const { return transferQueue; }
+  VkQueue getComputeQueue() const { return computeQueue; }
   VkSurfaceKHR getSurface() const { return surface; }
-  Window &getWindow() { return window; }
+  Window &getWindow() { return *window; }
+  bool isHeadless() const { return window == nullptr; }
+  VkExtent2D getOffscreenExtent() const { return offscreenExtent; }
   VulkanSwapChain &getSwapChain() { return vulkanSwapChain; }
+  VulkanFrameCapture &getFrameCapture() { return vulkanFrameCapture; }
   VulkanPipeLine &getPipeLine() { return vulkanPipeLine; }
   VulkanRenderer &getRenderer() { return vulkanRenderer; }
+  VulkanPipeLineCache &getPipeLineCache() { return vulkanPipeLineCache; }
+  VulkanPipeLineManager &getPipeLineManager() { return vulkanPipeLineManager; }
+  VulkanProfiler &getProfiler() { return vulkanProfiler; }
+  VulkanMemoryAllocator &getMemoryAllocator() { return vulkanMemoryAllocator; }
+  VulkanStagingRing &getStagingRing() { return vulkanStagingRing; }
+  VulkanMeshBuffer &getMeshBuffer() { return vulkanMeshBuffer; }
+  VulkanUniformRing &getUniformRing() { return vulkanUniformRing; }
+  VulkanInstanceBuffer &getInstanceBuffer() { return vulkanInstanceBuffer; }
+  VulkanCullingPass &getCullingPass() { return vulkanCullingPass; }
+  VulkanQueueScheduler &getQueueScheduler() { return vulkanQueueScheduler; }
+  VulkanHostAllocator &getHostAllocator() { return hostAllocator; }
+  // Passed to every vkCreate* and vkDestroy* call, see VulkanHostAllocator.
+  const VkAllocationCallbacks *getAllocationCallbacks() const {
+    return hostAllocator.getCallbacks();
+  }
+  const VkPhysicalDeviceFeatures &getEnabledFeatures() const { return enabledFeatures; }
+  const VkPhysicalDeviceVulkan12Features &getEnabledVulkan12Features() const {
+    return enabledVulkan12Features;
+  }
+  const VkPhysicalDeviceVulkan13Features &getEnabledVulkan13Features() const {
+    return enabledVulkan13Features;
+  }
+  // True when rendering goes through vkCmdBeginRendering, see
+  // DeviceConfig::dynamicRendering.
+  bool usesDynamicRendering() const {
+    return enabledVulkan13Features.dynamicRendering == VK_TRUE;
+  }
+  // True when VK_EXT_memory_budget is enabled, see
+  // VulkanMemoryAllocator::updateBudget().
+  bool hasMemoryBudget() const { return memoryBudgetEnabled; }
+  // True when VK_EXT_swapchain_maintenance1 is enabled, so presents can
+  // signal a fence, see VulkanRenderer::retireAfterPresents().
+  bool hasPresentFences() const { return presentFencesEnabled; }
+  const DeviceConfig &getConfig() const { return config; }
   VkQueue &getPresentQueue() { return presentQueue; }
 
 private:
   VkInstance instance;
-  const std::vector<const char*> deviceExtensions = {
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME
-  };
-  VkSurfaceKHR surface;
+  std::vector<const char*> deviceExtensions;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-
+  VkQueue transferQueue;
+  VkQueue computeQueue;
+  VkPhysicalDeviceFeatures enabledFeatures{};
+  VkPhysicalDeviceVulkan12Features enabledVulkan12Features{};
+  VkPhysicalDeviceVulkan13Features enabledVulkan13Features{};
+  bool memoryBudgetEnabled = false;
+  bool surfaceMaintenanceEnabled = false;
+  bool presentFencesEnabled = false;
+  std::optional<QueueFamilyIndices> selectedQueueFamilies;
+
+  // Declared before the subsystems, so it outlives every object they
+  // destroy through it.
+  VulkanHostAllocator hostAllocator;
   ValidationLayers validationLayers;
+  VulkanMemoryAllocator vulkanMemoryAllocator;
+  VulkanQueueScheduler vulkanQueueScheduler;
+  VulkanPipeLineCache vulkanPipeLineCache;
+  VulkanPipeLineManager vulkanPipeLineManager;
+  VulkanStagingRing vulkanStagingRing;
+  VulkanMeshBuffer vulkanMeshBuffer;
+  VulkanUniformRing vulkanUniformRing;
+  VulkanInstanceBuffer vulkanInstanceBuffer;
+  VulkanCullingPass vulkanCullingPass;
   VulkanSwapChain vulkanSwapChain;
+  VulkanFrameCapture vulkanFrameCapture;
   VulkanPipeLine vulkanPipeLine;
   VulkanRenderer vulkanRenderer;
+  VulkanProfiler vulkanProfiler;
+
+  Window *window;
+  VkExtent2D offscreenExtent;
+  DeviceConfig config;
 
-  Window &window;
+  VulkanDevice(Window *window, VkExtent2D offscreenExtent,
+               const DeviceConfig &config);
 
   void initVulkan();
   void createInstance();
@@ -69,8 +203,18 @@ private:
   void createSurface();
 
   void pickPhysicalDevice();
+  void selectPhysicalDevice(VkPhysicalDevice device, int score,
+                            const char *reason);
+  // 0 when the device cannot run the renderer, else higher is better.
   int rateDeviceSuitability(VkPhysicalDevice device);
+  static std::string deviceUuid(VkPhysicalDevice device);
+  static bool matchesDevice(VkPhysicalDevice device,
+                            const std::string &requested);
+  bool loadDeviceChoice(std::string &uuid, uint32_t &driverVersion);
+  void saveDeviceChoice();
+  std::string deviceRequirements() const;
   bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+  bool supportsDeviceExtension(VkPhysicalDevice device, const char *name);
 
   void createLogicalDevice();
 
@@ -0,0 +1,466 @@
+#include "VulkanFrameCapture.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+VulkanFrameCapture::VulkanFrameCapture(VulkanDevice &device) : device(device) {}
+
+void VulkanFrameCapture::create(uint32_t framesInFlight) {
+  const DeviceConfig &config = device.getConfig();
+  if (config.capturePath.empty()) return;
+
+  VulkanSwapChain &swapChain = device.getSwapChain();
+  if (!(swapChain.getImageUsage() & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    std::cerr << "Frame capture disabled: the surface does not allow copying "
+                 "from swap chain images" << std::endl;
+    return;
+  }
+
+  if (!isReadableFormat(swapChain.getSwapChainImageFormat(), swapRedBlue)) {
+    std::cerr << "Frame capture disabled: the swap chain format is not 8-bit "
+                 "RGBA or BGRA" << std::endl;
+    return;
+  }
+
+  format = config.captureFormat;
+  extent = swapChain.getSwapChainExtent();
+  frameSize = VkDeviceSize(extent.width) * extent.height * 4;
+
+  out = &std::cout;
+  if (config.capturePath != "-") {
+    file.open(config.capturePath, std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("failed to open " + config.capturePath +
+                               " for writing!");
+    }
+    out = &file;
+  }
+
+  if (format == Y4M) {
+    *out << "YUV4MPEG2 W" << extent.width << " H" << extent.height << " F"
+         << config.captureFps << ":1 Ip A1:1 C420jpeg\n";
+    uint32_t chromaWidth = (extent.width + 1) / 2;
+    uint32_t chromaHeight = (extent.height + 1) / 2;
+    scratch.resize(size_t(extent.width) * extent.height +
+                   2 * size_t(chromaWidth) * chromaHeight);
+  } else if (swapRedBlue) {
+    scratch.resize(frameSize);
+  }
+
+  VkMemoryPropertyFlags properties = readbackMemoryProperties();
+  slots.resize(framesInFlight + EXTRA_SLOTS);
+  for (auto &slot : slots) {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = frameSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    device.getMemoryAllocator().createBuffer(bufferInfo, properties,
+                                             slot.buffer, slot.allocation);
+  }
+
+  nextSlot = 0;
+  recordedSlot = UINT32_MAX;
+  stopping = false;
+  writtenFrames = 0;
+  failure = nullptr;
+  writer = std::thread(&VulkanFrameCapture::writerLoop, this);
+  enabled = true;
+}
+
+void VulkanFrameCapture::cleanup() {
+  if (!enabled) return;
+  enabled = false;
+
+  // The writer drains the queue before it stops, waiting for the frames
+  // still on the GPU.
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_all();
+  writer.join();
+
+  for (auto &slot : slots) {
+    device.getMemoryAllocator().destroyBuffer(slot.buffer, slot.allocation);
+  }
+  slots.clear();
+  queue.clear();
+  scratch.clear();
+
+  out->flush();
+  out = nullptr;
+  if (file.is_open()) {
+    file.close();
+  }
+}
+
+bool VulkanFrameCapture::isReadableFormat(VkFormat format, bool &bgra) {
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_R8G8B8A8_UNORM:
+    bgra = false;
+    return true;
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+    bgra = true;
+    return true;
+  default:
+    return false;
+  }
+}
+
+VkMemoryPropertyFlags VulkanFrameCapture::readbackMemoryProperties() const {
+  // Uncached memory is write-combined on most devices, and reading a frame
+  // from it takes many times longer than from cached memory.
+  VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkMemoryPropertyFlags cached = properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device.getPhysicalDevice(),
+                                      &memoryProperties);
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((memoryProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+      return cached;
+    }
+  }
+  return properties;
+}
+
+void VulkanFrameCapture::recordCopy(VkCommandBuffer commandBuffer,
+                                    VkImage image) {
+  uint32_t index;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this] { return !slots[nextSlot].busy; });
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
+    index = nextSlot;
+    slots[index].busy = true;
+  }
+  nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+  recordedSlot = index;
+
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {extent.width, extent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         slots[index].buffer, 1, &region);
+
+  // Makes the copy visible to the host once the writer has waited for the
+  // frame's timeline value.
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+}
+
+void VulkanFrameCapture::recordAfterRenderPass(VkCommandBuffer commandBuffer,
+                                               VkImage image,
+                                               VkImageLayout layout) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  // Also needed when the render pass already left the image in
+  // TRANSFER_SRC_OPTIMAL: nothing else orders the copy after the rendering.
+  barrier.oldLayout = layout;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  recordCopy(commandBuffer, image);
+
+  if (layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) return;
+
+  // Presentation is ordered by the render finished semaphore.
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = layout;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = 0;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+}
+
+void VulkanFrameCapture::submit(uint64_t value) {
+  if (recordedSlot == UINT32_MAX) return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[recordedSlot].value = value;
+    queue.push_back(recordedSlot);
+  }
+  queued.notify_one();
+  recordedSlot = UINT32_MAX;
+}
+
+void VulkanFrameCapture::checkExtent() {
+  if (!enabled) return;
+
+  VkExtent2D current = device.getSwapChain().getSwapChainExtent();
+  if (current.width == extent.width && current.height == extent.height) {
+    return;
+  }
+
+  std::cerr << "Frame capture stopped: the swap chain changed size from "
+            << extent.width << "x" << extent.height << " to " << current.width
+            << "x" << current.height << std::endl;
+  cleanup();
+}
+
+void VulkanFrameCapture::readImage(VkImage image, std::vector<uint8_t> &rgba) {
+  VulkanSwapChain &swapChain = device.getSwapChain();
+  bool bgra;
+  if (!isReadableFormat(swapChain.getSwapChainImageFormat(), bgra)) {
+    throw std::runtime_error("cannot read back swap chain images of this format!");
+  }
+  VkExtent2D imageExtent = swapChain.getSwapChainExtent();
+  VkDeviceSize size = VkDeviceSize(imageExtent.width) * imageExtent.height * 4;
+
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer buffer;
+  VulkanAllocation allocation;
+  device.getMemoryAllocator().createBuffer(bufferInfo, readbackMemoryProperties(),
+                                           buffer, allocation);
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex =
+      device.findQueueFamilies(device.getPhysicalDevice()).graphicsFamily.value();
+  VkCommandPool commandPool;
+  if (vkCreateCommandPool(device.getDevice(), &poolInfo,
+                          device.getAllocationCallbacks(),
+                          &commandPool) != VK_SUCCESS) {
+    device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+    throw std::runtime_error("failed to create readback command pool!");
+  }
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+  VkCommandBuffer commandBuffer;
+  vkAllocateCommandBuffers(device.getDevice(), &allocInfo, &commandBuffer);
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = {imageExtent.width, imageExtent.height, 1};
+  vkCmdCopyImageToBuffer(commandBuffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                         &region);
+
+  VkMemoryBarrier hostBarrier{};
+  hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0,
+                       nullptr, 0, nullptr);
+  vkEndCommandBuffer(commandBuffer);
+
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  uint64_t value = scheduler.nextValue(VulkanQueueScheduler::GRAPHICS);
+  VkSemaphore timeline = scheduler.getTimeline(VulkanQueueScheduler::GRAPHICS);
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &value;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &timeline;
+
+  VkResult result =
+      vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
+  if (result == VK_SUCCESS) {
+    scheduler.wait(VulkanQueueScheduler::GRAPHICS, value);
+
+    const uint8_t *pixels = static_cast<const uint8_t *>(allocation.mapped);
+    rgba.assign(pixels, pixels + size);
+    if (bgra) {
+      for (VkDeviceSize i = 0; i < size; i += 4) {
+        std::swap(rgba[i], rgba[i + 2]);
+      }
+    }
+  }
+
+  vkDestroyCommandPool(device.getDevice(), commandPool,
+                       device.getAllocationCallbacks());
+  device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit readback copy!");
+  }
+}
+
+uint64_t VulkanFrameCapture::getWrittenFrameCount() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return writtenFrames;
+}
+
+void VulkanFrameCapture::writerLoop() {
+  for (;;) {
+    uint32_t index;
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queued.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      index = queue.front();
+      queue.pop_front();
+      failed = failure != nullptr;
+    }
+
+    // Once a write failed the stream is broken; buffers are still handed
+    // back so the render thread gets to see the error.
+    bool written = false;
+    if (!failed) {
+      try {
+        device.getQueueScheduler().wait(VulkanQueueScheduler::GRAPHICS,
+                                        slots[index].value);
+        writeFrame(static_cast<const uint8_t *>(slots[index].allocation.mapped));
+        written = true;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failure = std::current_exception();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slots[index].busy = false;
+      if (written) writtenFrames++;
+    }
+    released.notify_one();
+  }
+}
+
+void VulkanFrameCapture::writeFrame(const uint8_t *pixels) {
+  if (format == Y4M) {
+    convertToYuv(pixels);
+    *out << "FRAME\n";
+    out->write(reinterpret_cast<const char *>(scratch.data()),
+               static_cast<std::streamsize>(scratch.size()));
+  } else if (swapRedBlue) {
+    for (VkDeviceSize i = 0; i < frameSize; i += 4) {
+      scratch[i] = pixels[i + 2];
+      scratch[i + 1] = pixels[i + 1];
+      scratch[i + 2] = pixels[i];
+      scratch[i + 3] = pixels[i + 3];
+    }
+    out->write(reinterpret_cast<const char *>(scratch.data()),
+               static_cast<std::streamsize>(frameSize));
+  } else {
+    out->write(reinterpret_cast<const char *>(pixels),
+               static_cast<std::streamsize>(frameSize));
+  }
+
+  if (!*out) {
+    throw std::runtime_error("failed to write captured frame to " +
+                             device.getConfig().capturePath + "!");
+  }
+}
+
+void VulkanFrameCapture::convertToYuv(const uint8_t *pixels) {
+  // Full-range BT.601 in 8.8 fixed point, as the C420jpeg tag expects. The
+  // chroma offset of 128 is folded into the rounding term so the shifted
+  // values are never negative.
+  const uint32_t width = extent.width;
+  const uint32_t height = extent.height;
+  const uint32_t chromaWidth = (width + 1) / 2;
+  const uint32_t chromaHeight = (height + 1) / 2;
+  const int red = swapRedBlue ? 2 : 0;
+  const int blue = 2 - red;
+
+  uint8_t *yPlane = scratch.data();
+  uint8_t *uPlane = yPlane + size_t(width) * height;
+  uint8_t *vPlane = uPlane + size_t(chromaWidth) * chromaHeight;
+
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *row = pixels + size_t(y) * width * 4;
+    for (uint32_t x = 0; x < width; x++) {
+      const uint8_t *pixel = row + size_t(x) * 4;
+      yPlane[size_t(y) * width + x] = static_cast<uint8_t>(
+          (77 * pixel[red] + 150 * pixel[1] + 29 * pixel[blue] + 128) >> 8);
+    }
+  }
+
+  // Each chroma sample averages a 2x2 block, clamped at odd edges.
+  for (uint32_t cy = 0; cy < chromaHeight; cy++) {
+    uint32_t y0 = cy * 2;
+    uint32_t y1 = std::min(y0 + 1, height - 1);
+    for (uint32_t cx = 0; cx < chromaWidth; cx++) {
+      uint32_t x0 = cx * 2;
+      uint32_t x1 = std::min(x0 + 1, width - 1);
+      const uint8_t *block[] = {
+          pixels + (size_t(y0) * width + x0) * 4,
+          pixels + (size_t(y0) * width + x1) * 4,
+          pixels + (size_t(y1) * width + x0) * 4,
+          pixels + (size_t(y1) * width + x1) * 4};
+
+      int r = 2, g = 2, b = 2;
+      for (const uint8_t *pixel : block) {
+        r += pixel[red];
+        g += pixel[1];
+        b += pixel[blue];
+      }
+      r >>= 2;
+      g >>= 2;
+      b >>= 2;
+
+      size_t index = size_t(cy) * chromaWidth + cx;
+      uPlane[index] = static_cast<uint8_t>(
+          std::min((-43 * r - 85 * g + 128 * b + 32896) >> 8, 255));
+      vPlane[index] = static_cast<uint8_t>(
+          std::min((128 * r - 107 * g - 21 * b + 32896) >> 8, 255));
+    }
+  }
+}
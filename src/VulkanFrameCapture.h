@@ -0,0 +1,119 @@
+#ifndef VULKAN_FRAME_CAPTURE_H
+#define VULKAN_FRAME_CAPTURE_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Streams every rendered frame to a file, or to stdout for piping into an
+// encoder, without the GPU or the render thread waiting for the readback.
+//
+// Each frame is copied into the next buffer of a ring of persistently mapped
+// host buffers, in the frame's own command buffer. A writer thread waits for
+// the frame's graphics timeline value, converts the pixels and writes them
+// out, then hands the buffer back. The render thread only ever waits when
+// the writer has fallen a whole ring behind, which keeps a slow disk from
+// growing an unbounded queue.
+//
+// Frames are written as raw RGBA8, or as a YUV4MPEG2 stream in 4:2:0 with
+// full-range BT.601 colors. Capture stops when the swap chain changes size,
+// since neither format can change it mid-stream.
+class VulkanFrameCapture {
+public:
+  enum Format { RAW_RGBA, Y4M };
+
+  // Buffers beyond frames in flight, so the writer can lag behind the GPU
+  // for a couple of frames before recording has to wait for it.
+  static constexpr uint32_t EXTRA_SLOTS = 2;
+
+  VulkanFrameCapture(VulkanDevice &device);
+
+  VulkanFrameCapture(const VulkanFrameCapture &) = delete;
+  VulkanFrameCapture &operator=(const VulkanFrameCapture &) = delete;
+
+  // Opens DeviceConfig::capturePath and creates the ring for the current
+  // swap chain; does nothing when no path is set.
+  void create(uint32_t framesInFlight);
+  // Writes out every frame still in flight and closes the stream.
+  void cleanup();
+
+  bool isEnabled() const { return enabled; }
+
+  // Copies image into the next buffer of the ring. The image must be in
+  // TRANSFER_SRC_OPTIMAL with the rendering made visible to transfer reads.
+  void recordCopy(VkCommandBuffer commandBuffer, VkImage image);
+  // recordCopy() for an image a render pass just left in layout, with the
+  // barriers to copy from it and to return it to layout afterwards.
+  void recordAfterRenderPass(VkCommandBuffer commandBuffer, VkImage image,
+                             VkImageLayout layout);
+  // Queues the buffer recorded this frame for writing once the graphics
+  // timeline reaches value.
+  void submit(uint64_t value);
+  // Stops capturing if the swap chain no longer has the stream's extent.
+  void checkExtent();
+
+  // Copies one swap chain image into rgba straight away, for tools checking
+  // a single frame rather than streaming. The image must have been left in
+  // TRANSFER_SRC_OPTIMAL, as on a headless device. Works without capture
+  // being enabled.
+  void readImage(VkImage image, std::vector<uint8_t> &rgba);
+
+  uint64_t getWrittenFrameCount() const;
+
+private:
+  struct Slot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VulkanAllocation allocation;
+    uint64_t value = 0;
+    // Recorded or being written; not reusable until the writer is done.
+    bool busy = false;
+  };
+
+  VulkanDevice &device;
+
+  bool enabled = false;
+  Format format = RAW_RGBA;
+  VkExtent2D extent{};
+  VkDeviceSize frameSize = 0;
+  // BGRA swap chains are swizzled to RGBA while writing.
+  bool swapRedBlue = false;
+
+  std::ofstream file;
+  std::ostream *out = nullptr;
+  // Converted frame, reused by the writer.
+  std::vector<uint8_t> scratch;
+
+  std::vector<Slot> slots;
+  uint32_t nextSlot = 0;
+  // Slot recorded this frame and not yet submitted, or UINT32_MAX.
+  uint32_t recordedSlot = UINT32_MAX;
+
+  std::thread writer;
+  mutable std::mutex mutex;
+  std::condition_variable queued;
+  std::condition_variable released;
+  std::deque<uint32_t> queue;
+  bool stopping = false;
+  uint64_t writtenFrames = 0;
+  // First write error, rethrown on the render thread.
+  std::exception_ptr failure;
+
+  // False for formats other than 8-bit RGBA and BGRA.
+  static bool isReadableFormat(VkFormat format, bool &bgra);
+  VkMemoryPropertyFlags readbackMemoryProperties() const;
+  void writerLoop();
+  void writeFrame(const uint8_t *pixels);
+  void convertToYuv(const uint8_t *pixels);
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "VulkanHostAllocator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+// Sits right in front of every pointer handed to the driver, so frees and
+// reallocations know where the memory came from.
+struct VulkanHostAllocator::Header {
+  void *base;
+  size_t size;
+  uint32_t scope;
+  bool arena;
+};
+
+namespace {
+
+// Keeps the header, and so the pointer after it, aligned for any type.
+constexpr size_t HEADER_SIZE = 32;
+
+const char *scopeName(uint32_t scope) {
+  switch (scope) {
+  case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND: return "command";
+  case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT: return "object";
+  case VK_SYSTEM_ALLOCATION_SCOPE_CACHE: return "cache";
+  case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE: return "device";
+  case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+  default: return "unknown";
+  }
+}
+
+void raiseTo(std::atomic<uint64_t> &peak, uint64_t value) {
+  uint64_t current = peak.load();
+  while (value > current && !peak.compare_exchange_weak(current, value)) {
+  }
+}
+
+uintptr_t alignUp(uintptr_t value, size_t alignment) {
+  return (value + alignment - 1) & ~uintptr_t(alignment - 1);
+}
+
+std::atomic<uint64_t> nextAllocatorId{1};
+
+} // namespace
+
+thread_local VulkanHostAllocator::ThreadSlot VulkanHostAllocator::threadSlot;
+
+VulkanHostAllocator::VulkanHostAllocator(size_t arenaSize)
+    : id(nextAllocatorId.fetch_add(1)), arenaSize(arenaSize) {
+  static_assert(sizeof(Header) <= HEADER_SIZE, "header does not fit");
+
+  callbacks.pUserData = this;
+  callbacks.pfnAllocation = allocationCallback;
+  callbacks.pfnReallocation = reallocationCallback;
+  callbacks.pfnFree = freeCallback;
+  callbacks.pfnInternalAllocation = internalAllocationCallback;
+  callbacks.pfnInternalFree = internalFreeCallback;
+}
+
+void VulkanHostAllocator::beginFrame() {
+  if (threadArena() == nullptr) {
+    addRenderThread();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(renderThreadsMutex);
+    for (auto &arena : arenas) {
+      size_t used = arena->used.exchange(0);
+      size_t peak = arena->peak.load();
+      while (used > peak && !arena->peak.compare_exchange_weak(peak, used)) {
+      }
+    }
+  }
+
+  // The first frame is mostly one-off setup and would swamp the peak.
+  uint64_t allocations = frameAllocations.exchange(0);
+  uint64_t frame = frames.fetch_add(1);
+  if (frame == 0) return;
+  lastFrameAllocations.store(allocations);
+  totalFrameAllocations.fetch_add(allocations);
+  if (frame > 1) {
+    raiseTo(peakFrameAllocations, allocations);
+  }
+}
+
+void VulkanHostAllocator::addRenderThread() {
+  auto arena = std::make_unique<Arena>();
+  arena->memory.reset(new unsigned char[arenaSize]);
+  threadSlot = {id, arena.get()};
+
+  std::lock_guard<std::mutex> lock(renderThreadsMutex);
+  arenas.push_back(std::move(arena));
+}
+
+VulkanHostAllocator::Arena *VulkanHostAllocator::threadArena() const {
+  return threadSlot.allocator == id ? threadSlot.arena : nullptr;
+}
+
+VulkanHostAllocator::ScopeStats
+VulkanHostAllocator::getScopeStats(VkSystemAllocationScope scope) const {
+  const Counters &counter = counters[scope];
+  ScopeStats stats;
+  stats.allocationCount = counter.allocationCount.load();
+  stats.arenaCount = counter.arenaCount.load();
+  stats.liveCount = counter.liveCount.load();
+  stats.liveBytes = counter.liveBytes.load();
+  stats.peakBytes = counter.peakBytes.load();
+  stats.internalBytes = counter.internalBytes.load();
+  return stats;
+}
+
+VulkanHostAllocator::FrameStats VulkanHostAllocator::getFrameStats() const {
+  FrameStats stats;
+  // The frame in progress is not counted.
+  uint64_t started = frames.load();
+  stats.frames = started > 1 ? started - 1 : 0;
+  stats.lastFrameAllocations = lastFrameAllocations.load();
+  stats.peakFrameAllocations = peakFrameAllocations.load();
+  stats.totalFrameAllocations = totalFrameAllocations.load();
+  stats.otherThreadAllocations = otherThreadAllocations.load();
+  stats.arenaOverflows = arenaOverflows.load();
+
+  std::lock_guard<std::mutex> lock(renderThreadsMutex);
+  for (const auto &arena : arenas) {
+    stats.arenaPeakBytes = std::max(
+        {stats.arenaPeakBytes, arena->peak.load(), arena->used.load()});
+  }
+  stats.renderThreads = static_cast<uint32_t>(arenas.size());
+  return stats;
+}
+
+void VulkanHostAllocator::writeStats(std::ostream &out) const {
+  std::ios::fmtflags flags = out.flags();
+
+  out << "Host allocations by scope:\n";
+  for (uint32_t scope = 0; scope < SCOPE_COUNT; scope++) {
+    ScopeStats stats = getScopeStats(static_cast<VkSystemAllocationScope>(scope));
+    out << "  " << std::left << std::setw(9) << scopeName(scope) << std::right
+        << stats.allocationCount << " allocations (" << stats.arenaCount
+        << " from the arena), " << stats.liveCount << " live, "
+        << stats.liveBytes << " bytes live, " << stats.peakBytes
+        << " bytes peak, " << stats.internalBytes << " bytes internal\n";
+  }
+
+  FrameStats frame = getFrameStats();
+  double average = frame.frames > 0
+                       ? double(frame.totalFrameAllocations) / frame.frames
+                       : 0.0;
+  out << "Host allocations per frame in the render loop ("
+      << frame.renderThreads << " threads): " << std::fixed
+      << std::setprecision(2) << average << " average, "
+      << frame.peakFrameAllocations << " peak, " << frame.lastFrameAllocations
+      << " last, over " << frame.frames << " frames\n";
+  out << "Host allocations outside the render loop: "
+      << frame.otherThreadAllocations << "\n";
+  out << "Command arenas: " << frame.arenaPeakBytes << " of " << arenaSize
+      << " bytes peak per thread, " << frame.arenaOverflows << " overflows"
+      << std::endl;
+
+  out.flags(flags);
+}
+
+void *VulkanHostAllocator::allocate(size_t size, size_t alignment,
+                                    VkSystemAllocationScope scope) {
+  if (size == 0) return nullptr;
+  alignment = std::max(alignment, alignof(Header));
+
+  Counters &counter = counters[scope];
+  void *memory = nullptr;
+  bool fromArena = false;
+  Arena *arena = threadArena();
+
+  if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && arena != nullptr) {
+    memory = allocateFromArena(*arena, size, alignment);
+    fromArena = memory != nullptr;
+    if (!fromArena) {
+      arenaOverflows.fetch_add(1);
+    }
+  }
+
+  if (!fromArena) {
+    size_t total = size + alignment + HEADER_SIZE;
+    void *base = std::malloc(total);
+    if (base == nullptr) return nullptr;
+    memory = reinterpret_cast<void *>(alignUp(
+        reinterpret_cast<uintptr_t>(base) + HEADER_SIZE, alignment));
+    Header *header =
+        reinterpret_cast<Header *>(static_cast<char *>(memory) - HEADER_SIZE);
+    header->base = base;
+    if (arena != nullptr) {
+      frameAllocations.fetch_add(1);
+    } else {
+      otherThreadAllocations.fetch_add(1);
+    }
+  }
+
+  Header *header =
+      reinterpret_cast<Header *>(static_cast<char *>(memory) - HEADER_SIZE);
+  header->size = size;
+  header->scope = scope;
+  header->arena = fromArena;
+
+  counter.allocationCount.fetch_add(1);
+  if (fromArena) {
+    counter.arenaCount.fetch_add(1);
+  }
+  counter.liveCount.fetch_add(1);
+  raiseTo(counter.peakBytes, counter.liveBytes.fetch_add(size) + size);
+  return memory;
+}
+
+void *VulkanHostAllocator::allocateFromArena(Arena &arena, size_t size,
+                                             size_t alignment) {
+  // Only the owning thread gets here, so a plain read-modify-write is safe.
+  uintptr_t start = reinterpret_cast<uintptr_t>(arena.memory.get());
+  uintptr_t memory = alignUp(start + arena.used.load() + HEADER_SIZE, alignment);
+  size_t end = memory + size - start;
+  if (end > arenaSize) return nullptr;
+
+  arena.used.store(end);
+  return reinterpret_cast<void *>(memory);
+}
+
+void *VulkanHostAllocator::reallocate(void *original, size_t size,
+                                      size_t alignment,
+                                      VkSystemAllocationScope scope) {
+  if (original == nullptr) return allocate(size, alignment, scope);
+  if (size == 0) {
+    free(original);
+    return nullptr;
+  }
+
+  const Header *header = reinterpret_cast<const Header *>(
+      static_cast<char *>(original) - HEADER_SIZE);
+  void *memory = allocate(size, alignment, scope);
+  if (memory == nullptr) return nullptr;
+  std::memcpy(memory, original, std::min(size, header->size));
+  free(original);
+  return memory;
+}
+
+void VulkanHostAllocator::free(void *memory) {
+  if (memory == nullptr) return;
+
+  Header *header =
+      reinterpret_cast<Header *>(static_cast<char *>(memory) - HEADER_SIZE);
+  Counters &counter = counters[header->scope];
+  counter.liveCount.fetch_sub(1);
+  counter.liveBytes.fetch_sub(header->size);
+
+  // Arena memory goes away with the next beginFrame().
+  if (!header->arena) {
+    std::free(header->base);
+  }
+}
+
+void *VKAPI_CALL VulkanHostAllocator::allocationCallback(
+    void *userData, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+  return static_cast<VulkanHostAllocator *>(userData)->allocate(size, alignment,
+                                                                scope);
+}
+
+void *VKAPI_CALL VulkanHostAllocator::reallocationCallback(
+    void *userData, void *original, size_t size, size_t alignment,
+    VkSystemAllocationScope scope) {
+  return static_cast<VulkanHostAllocator *>(userData)->reallocate(
+      original, size, alignment, scope);
+}
+
+void VKAPI_CALL VulkanHostAllocator::freeCallback(void *userData,
+                                                  void *memory) {
+  static_cast<VulkanHostAllocator *>(userData)->free(memory);
+}
+
+void VKAPI_CALL VulkanHostAllocator::internalAllocationCallback(
+    void *userData, size_t size, VkInternalAllocationType type,
+    VkSystemAllocationScope scope) {
+  static_cast<VulkanHostAllocator *>(userData)
+      ->counters[scope]
+      .internalBytes.fetch_add(size);
+}
+
+void VKAPI_CALL VulkanHostAllocator::internalFreeCallback(
+    void *userData, size_t size, VkInternalAllocationType type,
+    VkSystemAllocationScope scope) {
+  static_cast<VulkanHostAllocator *>(userData)
+      ->counters[scope]
+      .internalBytes.fetch_sub(size);
+}
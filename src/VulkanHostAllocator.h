@@ -0,0 +1,152 @@
+#ifndef VULKAN_HOST_ALLOCATOR_H
+#define VULKAN_HOST_ALLOCATOR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// The VkAllocationCallbacks every Vulkan object is created and destroyed
+// with, so the driver's host allocations can be counted instead of guessed.
+//
+// Allocations are tracked per VkSystemAllocationScope. COMMAND scope memory
+// only lives for the duration of one Vulkan call, so when a render loop
+// thread asks for it, it comes out of that thread's bump arena, which
+// beginFrame() resets wholesale, rather than from the heap. The render loop
+// is the thread calling beginFrame() plus whatever threads it records with
+// that called addRenderThread(). Other threads, like the pipeline compile
+// workers, can be in the middle of a call when the frame turns over and
+// always get heap memory.
+//
+// beginFrame() also closes the previous frame's count of the render loop's
+// heap allocations, which should settle at zero once it reaches a steady
+// state. Heap allocations made outside the render loop, like pipeline
+// compiles, are counted separately.
+class VulkanHostAllocator {
+public:
+  static constexpr size_t DEFAULT_ARENA_SIZE = 1024 * 1024;
+  static constexpr uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+  struct ScopeStats {
+    // Heap and arena allocations since creation.
+    uint64_t allocationCount = 0;
+    uint64_t arenaCount = 0;
+    uint64_t liveCount = 0;
+    uint64_t liveBytes = 0;
+    uint64_t peakBytes = 0;
+    // Reported through pfnInternalAllocation, which the driver makes itself.
+    uint64_t internalBytes = 0;
+  };
+
+  struct FrameStats {
+    uint64_t frames = 0;
+    // Heap allocations the render loop made in the last completed frame.
+    uint64_t lastFrameAllocations = 0;
+    // Most heap allocations any frame made, not counting the first.
+    uint64_t peakFrameAllocations = 0;
+    uint64_t totalFrameAllocations = 0;
+    // Heap allocations made outside the render loop, and by any thread
+    // before it joined, since creation.
+    uint64_t otherThreadAllocations = 0;
+    // Command scope requests an arena could not fit.
+    uint64_t arenaOverflows = 0;
+    // Fullest any one thread's arena got.
+    size_t arenaPeakBytes = 0;
+    uint32_t renderThreads = 0;
+  };
+
+  explicit VulkanHostAllocator(size_t arenaSize = DEFAULT_ARENA_SIZE);
+
+  VulkanHostAllocator(const VulkanHostAllocator &) = delete;
+  VulkanHostAllocator &operator=(const VulkanHostAllocator &) = delete;
+
+  const VkAllocationCallbacks *getCallbacks() const { return &callbacks; }
+
+  // Resets the arenas and starts counting a new frame. The calling thread
+  // joins the render loop. No other render loop thread may be inside a
+  // Vulkan call meanwhile.
+  void beginFrame();
+  // Counts the calling thread's heap allocations per frame and gives it an
+  // arena of its own. For threads that do per-frame work, like recording.
+  void addRenderThread();
+
+  ScopeStats getScopeStats(VkSystemAllocationScope scope) const;
+  FrameStats getFrameStats() const;
+  void writeStats(std::ostream &out) const;
+
+private:
+  struct Header;
+
+  struct Counters {
+    std::atomic<uint64_t> allocationCount{0};
+    std::atomic<uint64_t> arenaCount{0};
+    std::atomic<uint64_t> liveCount{0};
+    std::atomic<uint64_t> liveBytes{0};
+    std::atomic<uint64_t> peakBytes{0};
+    std::atomic<uint64_t> internalBytes{0};
+  };
+
+  VkAllocationCallbacks callbacks{};
+  std::array<Counters, SCOPE_COUNT> counters;
+
+  struct Arena {
+    std::unique_ptr<unsigned char[]> memory;
+    // Only the owning thread bumps it, but stats are read from others.
+    std::atomic<size_t> used{0};
+    std::atomic<size_t> peak{0};
+  };
+
+  // Tells apart allocators that end up at the same address, for the
+  // thread-local arena lookup.
+  uint64_t id;
+  size_t arenaSize;
+  // One per render loop thread; guarded by renderThreadsMutex, which only
+  // joining and beginFrame() take.
+  std::vector<std::unique_ptr<Arena>> arenas;
+  mutable std::mutex renderThreadsMutex;
+
+  struct ThreadSlot {
+    uint64_t allocator = 0;
+    Arena *arena = nullptr;
+  };
+  // Set by addRenderThread() on the thread it joins.
+  static thread_local ThreadSlot threadSlot;
+
+  std::atomic<uint64_t> frameAllocations{0};
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> lastFrameAllocations{0};
+  std::atomic<uint64_t> peakFrameAllocations{0};
+  std::atomic<uint64_t> totalFrameAllocations{0};
+  std::atomic<uint64_t> otherThreadAllocations{0};
+  std::atomic<uint64_t> arenaOverflows{0};
+
+  void *allocate(size_t size, size_t alignment,
+                 VkSystemAllocationScope scope);
+  void *reallocate(void *original, size_t size, size_t alignment,
+                   VkSystemAllocationScope scope);
+  void free(void *memory);
+  // The calling thread's arena, or null outside the render loop.
+  Arena *threadArena() const;
+  void *allocateFromArena(Arena &arena, size_t size, size_t alignment);
+
+  static VKAPI_ATTR void *VKAPI_CALL allocationCallback(
+      void *userData, size_t size, size_t alignment,
+      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void *VKAPI_CALL reallocationCallback(
+      void *userData, void *original, size_t size, size_t alignment,
+      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL freeCallback(void *userData, void *memory);
+  static VKAPI_ATTR void VKAPI_CALL internalAllocationCallback(
+      void *userData, size_t size, VkInternalAllocationType type,
+      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL internalFreeCallback(
+      void *userData, size_t size, VkInternalAllocationType type,
+      VkSystemAllocationScope scope);
+};
+
+#endif
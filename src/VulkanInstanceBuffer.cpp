@@ -0,0 +1,190 @@
+#include "VulkanInstanceBuffer.h"
+#include "VulkanDevice.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Fixed step so a given frame always renders the same image.
+constexpr float TIME_STEP = 1.0f / 60.0f;
+
+// Small deterministic generator; the layout only has to look scattered.
+struct Random {
+  uint32_t state = 0x9e3779b9u;
+
+  float next() {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+  }
+};
+
+// Moves one axis and bounces off the edges of the world. Selects instead of
+// branches, and restrict-qualified streams, let the loop vectorize.
+void advance(float *__restrict position, float *__restrict velocity,
+             uint32_t count) {
+  constexpr float extent = VulkanInstanceBuffer::WORLD_EXTENT;
+  for (uint32_t i = 0; i < count; i++) {
+    float p = position[i] + velocity[i] * TIME_STEP;
+    float v = velocity[i];
+    v = (p > extent || p < -extent) ? -v : v;
+    p = p > extent ? 2.0f * extent - p : p;
+    p = p < -extent ? -2.0f * extent - p : p;
+    position[i] = p;
+    velocity[i] = v;
+  }
+}
+
+} // namespace
+
+VulkanInstanceBuffer::VulkanInstanceBuffer(VulkanDevice &device)
+    : device(device) {}
+
+void VulkanInstanceBuffer::create(uint32_t instanceCount,
+                                  uint32_t framesInFlight) {
+  this->instanceCount = instanceCount;
+  initInstances();
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+
+  VkDeviceSize streamsSize = VkDeviceSize(instanceCount) * STREAM_COUNT * sizeof(uint32_t);
+  if (streamsSize > properties.limits.maxStorageBufferRange) {
+    throw std::runtime_error("instance count exceeds maxStorageBufferRange!");
+  }
+
+  VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+  frameSize = (streamsSize + alignment - 1) & ~(alignment - 1);
+
+  device.createBuffer(frameSize * framesInFlight,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      buffer, allocation);
+
+  createDescriptorSet();
+
+  // Every region starts out valid, whichever frame renders first.
+  for (uint32_t frame = 0; frame < framesInFlight; frame++) {
+    update(frame);
+  }
+}
+
+void VulkanInstanceBuffer::initInstances() {
+  offsetX.assign(instanceCount, 0.0f);
+  offsetY.assign(instanceCount, 0.0f);
+  scale.assign(instanceCount, 1.0f);
+  color.assign(instanceCount, 0xffffffffu);
+  velocityX.assign(instanceCount, 0.0f);
+  velocityY.assign(instanceCount, 0.0f);
+
+  // A single instance is the plain triangle, left where it is.
+  if (instanceCount == 1) return;
+
+  Random random;
+  for (uint32_t i = 0; i < instanceCount; i++) {
+    offsetX[i] = (random.next() * 2.0f - 1.0f) * WORLD_EXTENT;
+    offsetY[i] = (random.next() * 2.0f - 1.0f) * WORLD_EXTENT;
+    scale[i] = 0.02f + random.next() * 0.06f;
+    velocityX[i] = (random.next() - 0.5f) * 0.5f;
+    velocityY[i] = (random.next() - 0.5f) * 0.5f;
+
+    uint32_t r = static_cast<uint32_t>(64 + random.next() * 191);
+    uint32_t g = static_cast<uint32_t>(64 + random.next() * 191);
+    uint32_t b = static_cast<uint32_t>(64 + random.next() * 191);
+    color[i] = r | (g << 8) | (b << 16) | (0xffu << 24);
+  }
+}
+
+void VulkanInstanceBuffer::createDescriptorSet() {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  // The culling pass reads the same streams from its compute shader.
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+
+  if (vkCreateDescriptorSetLayout(device.getDevice(), &layoutInfo,
+                                  device.getAllocationCallbacks(),
+                                  &descriptorSetLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create instance descriptor set layout!");
+  }
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(device.getDevice(), &poolInfo,
+                             device.getAllocationCallbacks(),
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create instance descriptor pool!");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &descriptorSetLayout;
+
+  if (vkAllocateDescriptorSets(device.getDevice(), &allocInfo,
+                               &descriptorSet) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate instance descriptor set!");
+  }
+
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = frameSize;
+
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &bufferInfo;
+
+  vkUpdateDescriptorSets(device.getDevice(), 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanInstanceBuffer::cleanup() {
+  if (buffer == VK_NULL_HANDLE) return;
+
+  vkDestroyDescriptorPool(device.getDevice(), descriptorPool,
+                          device.getAllocationCallbacks());
+  vkDestroyDescriptorSetLayout(device.getDevice(), descriptorSetLayout,
+                               device.getAllocationCallbacks());
+  descriptorPool = VK_NULL_HANDLE;
+  descriptorSetLayout = VK_NULL_HANDLE;
+  descriptorSet = VK_NULL_HANDLE;
+
+  device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+  buffer = VK_NULL_HANDLE;
+}
+
+void VulkanInstanceBuffer::update(uint32_t frame) {
+  if (instanceCount > 1) {
+    advance(offsetX.data(), velocityX.data(), instanceCount);
+    advance(offsetY.data(), velocityY.data(), instanceCount);
+  }
+
+  // Whole streams go out with memcpy: sequential writes are what
+  // write-combined host-visible memory handles best.
+  char *region = static_cast<char *>(allocation.mapped) + frame * frameSize;
+  size_t streamSize = size_t(instanceCount) * sizeof(uint32_t);
+  std::memcpy(region, offsetX.data(), streamSize);
+  std::memcpy(region + streamSize, offsetY.data(), streamSize);
+  std::memcpy(region + 2 * streamSize, scale.data(), streamSize);
+  std::memcpy(region + 3 * streamSize, color.data(), streamSize);
+}
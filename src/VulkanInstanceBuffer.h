@@ -0,0 +1,67 @@
+#ifndef VULKAN_INSTANCE_BUFFER_H
+#define VULKAN_INSTANCE_BUFFER_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Per-instance transform and color for instanced draws, stored as structure
+// of arrays: every attribute is its own tightly packed stream, so the CPU
+// update loop walks contiguous floats the compiler can vectorize and the
+// shader reads only the streams it needs. The streams are simulated on the
+// CPU and copied into a host-visible storage buffer region per frame in
+// flight, selected through a STORAGE_BUFFER_DYNAMIC descriptor.
+class VulkanInstanceBuffer {
+public:
+  // Number of 32-bit streams the shader reads, in buffer order:
+  // offset x, offset y, scale, packed RGBA8 color.
+  static constexpr uint32_t STREAM_COUNT = 4;
+  // Instances roam [-WORLD_EXTENT, WORLD_EXTENT] on both axes, so only part
+  // of them is on screen at any time.
+  static constexpr float WORLD_EXTENT = 2.0f;
+
+  VulkanInstanceBuffer(VulkanDevice &device);
+
+  VulkanInstanceBuffer(const VulkanInstanceBuffer &) = delete;
+  VulkanInstanceBuffer &operator=(const VulkanInstanceBuffer &) = delete;
+
+  void create(uint32_t instanceCount, uint32_t framesInFlight);
+  void cleanup();
+
+  // Advances every instance by one fixed time step and writes the result to
+  // the given frame's region; that frame's last submission must have completed.
+  void update(uint32_t frame);
+
+  uint32_t getInstanceCount() const { return instanceCount; }
+  VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+  VkDescriptorSet getDescriptorSet() const { return descriptorSet; }
+  uint32_t getDynamicOffset(uint32_t frame) const {
+    return static_cast<uint32_t>(frame * frameSize);
+  }
+
+private:
+  VulkanDevice &device;
+  uint32_t instanceCount = 0;
+
+  std::vector<float> offsetX;
+  std::vector<float> offsetY;
+  std::vector<float> scale;
+  std::vector<uint32_t> color;
+  // Simulation-only streams, never uploaded.
+  std::vector<float> velocityX;
+  std::vector<float> velocityY;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VulkanAllocation allocation;
+  VkDeviceSize frameSize = 0;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  void initInstances();
+  void createDescriptorSet();
+};
+
+#endif
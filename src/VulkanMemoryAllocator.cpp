@@ -0,0 +1,592 @@
+#include "VulkanMemoryAllocator.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+VkDeviceSize roundUpPowerOfTwo(VkDeviceSize value) {
+  VkDeviceSize power = 1;
+  while (power < value) {
+    power <<= 1;
+  }
+  return power;
+}
+
+VkDeviceSize roundDownPowerOfTwo(VkDeviceSize value) {
+  VkDeviceSize power = 1;
+  while (power <= value / 2) {
+    power <<= 1;
+  }
+  return power;
+}
+
+} // namespace
+
+// One VkDeviceMemory block split buddy-style. Level 0 is the whole block and
+// every level below halves the node size, down to MIN_ALLOCATION_SIZE.
+struct VulkanMemoryBlock {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  char *mapped = nullptr;
+  VkDeviceSize size = 0;
+  uint32_t pool = 0;
+  // Bytes of nodes handed out, including the power-of-two rounding.
+  VkDeviceSize usedBytes = 0;
+  uint32_t allocationCount = 0;
+
+  std::vector<std::set<VkDeviceSize>> freeLists;
+  std::unordered_map<VkDeviceSize, uint32_t> allocatedLevels;
+
+  void init(VkDeviceSize blockSize) {
+    size = blockSize;
+    uint32_t levels = 1;
+    while ((size >> (levels - 1)) > VulkanMemoryAllocator::MIN_ALLOCATION_SIZE) {
+      levels++;
+    }
+    freeLists.assign(levels, {});
+    freeLists[0].insert(0);
+  }
+
+  bool allocate(VkDeviceSize requested, VkDeviceSize alignment,
+                VkDeviceSize &offset) {
+    VkDeviceSize nodeSize = roundUpPowerOfTwo(std::max(
+        {requested, alignment, VulkanMemoryAllocator::MIN_ALLOCATION_SIZE}));
+    if (nodeSize > size) return false;
+
+    uint32_t level = 0;
+    while ((size >> level) > nodeSize) {
+      level++;
+    }
+
+    int source = static_cast<int>(level);
+    while (source >= 0 && freeLists[source].empty()) {
+      source--;
+    }
+    if (source < 0) return false;
+
+    offset = *freeLists[source].begin();
+    freeLists[source].erase(freeLists[source].begin());
+
+    // Split down to the requested level, keeping the right halves free.
+    for (uint32_t split = source + 1; split <= level; split++) {
+      freeLists[split].insert(offset + (size >> split));
+    }
+
+    allocatedLevels[offset] = level;
+    usedBytes += nodeSize;
+    allocationCount++;
+    return true;
+  }
+
+  void free(VkDeviceSize offset) {
+    auto it = allocatedLevels.find(offset);
+    if (it == allocatedLevels.end()) {
+      throw std::runtime_error("freeing memory that was not allocated!");
+    }
+    uint32_t level = it->second;
+    allocatedLevels.erase(it);
+    usedBytes -= size >> level;
+    allocationCount--;
+
+    while (level > 0) {
+      VkDeviceSize buddy = offset ^ (size >> level);
+      if (freeLists[level].erase(buddy) == 0) break;
+      offset = std::min(offset, buddy);
+      level--;
+    }
+    freeLists[level].insert(offset);
+  }
+};
+
+VulkanMemoryAllocator::VulkanMemoryAllocator(VulkanDevice &device)
+    : device(device) {}
+
+VulkanMemoryAllocator::~VulkanMemoryAllocator() {}
+
+void VulkanMemoryAllocator::create() {
+  vkGetPhysicalDeviceMemoryProperties(device.getPhysicalDevice(), &memoryProperties);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+  bufferImageGranularity = properties.limits.bufferImageGranularity;
+
+  pools.clear();
+  pools.resize(memoryProperties.memoryTypeCount * 2);
+  heapStats = {};
+  for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+    heapStats[heap].heapSize = memoryProperties.memoryHeaps[heap].size;
+  }
+  underPressure = {};
+  updateBudget();
+}
+
+void VulkanMemoryAllocator::cleanup() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto &pool : pools) {
+    for (auto &block : pool) {
+      vkFreeMemory(device.getDevice(), block->memory,
+                   device.getAllocationCallbacks());
+    }
+  }
+  pools.clear();
+
+  for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+    if (heapStats[heap].allocationCount > 0) {
+      std::cerr << heapStats[heap].allocationCount
+                << " allocations still live in heap " << heap
+                << " at allocator cleanup" << std::endl;
+    }
+  }
+}
+
+uint32_t VulkanMemoryAllocator::poolIndex(uint32_t memoryType, bool linear) const {
+  // With a granularity of one byte linear and optimal resources can share
+  // blocks freely, so everything goes to the linear pool.
+  bool separate = bufferImageGranularity > 1 && !linear;
+  return memoryType * 2 + (separate ? 1 : 0);
+}
+
+VkDeviceSize VulkanMemoryAllocator::blockSizeFor(uint32_t memoryType) const {
+  // Small heaps (integrated GPUs' host-visible windows, BAR memory) get
+  // smaller blocks so a single block cannot claim most of the heap.
+  VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapOf(memoryType)].size;
+  return std::min(DEFAULT_BLOCK_SIZE, roundDownPowerOfTwo(heapSize / 8));
+}
+
+VkDeviceMemory VulkanMemoryAllocator::allocateMemory(VkDeviceSize size,
+                                                     uint32_t memoryType,
+                                                     const void *next,
+                                                     void **mapped) {
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.pNext = next;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  VkDeviceMemory memory;
+  if (vkAllocateMemory(device.getDevice(), &allocInfo,
+                       device.getAllocationCallbacks(), &memory) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory!");
+  }
+
+  *mapped = nullptr;
+  if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(device.getDevice(), memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+      vkFreeMemory(device.getDevice(), memory, device.getAllocationCallbacks());
+      throw std::runtime_error("failed to map device memory!");
+    }
+  }
+
+  HeapStats &stats = heapStats[heapOf(memoryType)];
+  stats.reservedBytes += size;
+  return memory;
+}
+
+bool VulkanMemoryAllocator::allocateFromPool(
+    uint32_t pool, const VkMemoryRequirements &requirements,
+    VulkanAllocation &allocation) {
+  for (auto &block : pools[pool]) {
+    VkDeviceSize offset;
+    if (block->allocate(requirements.size, requirements.alignment, offset)) {
+      allocation.memory = block->memory;
+      allocation.offset = offset;
+      allocation.mapped = block->mapped ? block->mapped + offset : nullptr;
+      allocation.block = block.get();
+      return true;
+    }
+  }
+  return false;
+}
+
+VulkanAllocation VulkanMemoryAllocator::allocateDedicated(
+    const VkMemoryRequirements &requirements, uint32_t memoryType,
+    VkBuffer buffer, VkImage image) {
+  VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+  dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+  dedicatedInfo.buffer = buffer;
+  dedicatedInfo.image = image;
+  bool bound = buffer != VK_NULL_HANDLE || image != VK_NULL_HANDLE;
+
+  VulkanAllocation allocation;
+  allocation.memory = allocateMemory(requirements.size, memoryType,
+                                     bound ? &dedicatedInfo : nullptr,
+                                     &allocation.mapped);
+  heapStats[heapOf(memoryType)].dedicatedCount++;
+  return allocation;
+}
+
+VulkanAllocation VulkanMemoryAllocator::allocate(
+    const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+    bool linear, bool dedicated) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return allocateLocked(requirements, properties, linear, dedicated,
+                        VK_NULL_HANDLE, VK_NULL_HANDLE);
+}
+
+VulkanAllocation VulkanMemoryAllocator::allocateLocked(
+    const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties,
+    bool linear, bool dedicated, VkBuffer buffer, VkImage image) {
+  uint32_t memoryType =
+      device.findMemoryType(requirements.memoryTypeBits, properties);
+  VkDeviceSize blockSize = blockSizeFor(memoryType);
+
+  VulkanAllocation allocation;
+  if (dedicated || requirements.size > blockSize / 2) {
+    allocation = allocateDedicated(requirements, memoryType, buffer, image);
+  } else {
+    uint32_t pool = poolIndex(memoryType, linear);
+    if (!allocateFromPool(pool, requirements, allocation)) {
+      auto block = std::make_unique<VulkanMemoryBlock>();
+      void *mapped;
+      block->memory = allocateMemory(blockSize, memoryType, nullptr, &mapped);
+      block->mapped = static_cast<char *>(mapped);
+      block->init(blockSize);
+      block->pool = pool;
+      pools[pool].push_back(std::move(block));
+      heapStats[heapOf(memoryType)].blockCount++;
+
+      if (!allocateFromPool(pool, requirements, allocation)) {
+        throw std::runtime_error("failed to sub-allocate from a new block!");
+      }
+    }
+  }
+
+  allocation.size = requirements.size;
+  allocation.memoryType = memoryType;
+
+  HeapStats &stats = heapStats[heapOf(memoryType)];
+  stats.allocationCount++;
+  stats.usedBytes += allocation.size;
+  return allocation;
+}
+
+void VulkanMemoryAllocator::free(VulkanAllocation &allocation) {
+  std::lock_guard<std::mutex> lock(mutex);
+  freeLocked(allocation);
+}
+
+void VulkanMemoryAllocator::freeLocked(VulkanAllocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE) return;
+
+  HeapStats &stats = heapStats[heapOf(allocation.memoryType)];
+  stats.allocationCount--;
+  stats.usedBytes -= allocation.size;
+
+  if (allocation.block == nullptr) {
+    vkFreeMemory(device.getDevice(), allocation.memory,
+                 device.getAllocationCallbacks());
+    stats.dedicatedCount--;
+    stats.reservedBytes -= allocation.size;
+  } else {
+    VulkanMemoryBlock *block = allocation.block;
+    block->free(allocation.offset);
+
+    // Keep one empty block per pool around to absorb allocate/free churn.
+    if (block->allocationCount == 0) {
+      auto &blocks = pools[block->pool];
+      size_t emptyBlocks = std::count_if(
+          blocks.begin(), blocks.end(),
+          [](const std::unique_ptr<VulkanMemoryBlock> &candidate) {
+            return candidate->allocationCount == 0;
+          });
+      if (emptyBlocks > 1) {
+        releaseBlock(block);
+      }
+    }
+  }
+
+  allocation = VulkanAllocation();
+}
+
+void VulkanMemoryAllocator::releaseBlock(const VulkanMemoryBlock *block) {
+  auto &blocks = pools[block->pool];
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    if (it->get() != block) continue;
+
+    HeapStats &stats = heapStats[heapOf(block->pool / 2)];
+    stats.blockCount--;
+    stats.reservedBytes -= block->size;
+    vkFreeMemory(device.getDevice(), block->memory,
+                 device.getAllocationCallbacks());
+    blocks.erase(it);
+    return;
+  }
+}
+
+void VulkanMemoryAllocator::createBuffer(const VkBufferCreateInfo &bufferInfo,
+                                         VkMemoryPropertyFlags properties,
+                                         VkBuffer &buffer,
+                                         VulkanAllocation &allocation) {
+  if (vkCreateBuffer(device.getDevice(), &bufferInfo,
+                     device.getAllocationCallbacks(), &buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer!");
+  }
+
+  VkMemoryDedicatedRequirements dedicatedRequirements{};
+  dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 requirements{};
+  requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  requirements.pNext = &dedicatedRequirements;
+
+  VkBufferMemoryRequirementsInfo2 requirementsInfo{};
+  requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+  requirementsInfo.buffer = buffer;
+  vkGetBufferMemoryRequirements2(device.getDevice(), &requirementsInfo, &requirements);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    allocation = allocateLocked(requirements.memoryRequirements, properties, true,
+                                dedicatedRequirements.prefersDedicatedAllocation,
+                                buffer, VK_NULL_HANDLE);
+  }
+
+  vkBindBufferMemory(device.getDevice(), buffer, allocation.memory, allocation.offset);
+}
+
+void VulkanMemoryAllocator::createImage(const VkImageCreateInfo &imageInfo,
+                                        VkMemoryPropertyFlags properties,
+                                        VkImage &image,
+                                        VulkanAllocation &allocation) {
+  if (vkCreateImage(device.getDevice(), &imageInfo,
+                    device.getAllocationCallbacks(), &image) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create image!");
+  }
+
+  VkMemoryDedicatedRequirements dedicatedRequirements{};
+  dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 requirements{};
+  requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  requirements.pNext = &dedicatedRequirements;
+
+  VkImageMemoryRequirementsInfo2 requirementsInfo{};
+  requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+  requirementsInfo.image = image;
+  vkGetImageMemoryRequirements2(device.getDevice(), &requirementsInfo, &requirements);
+
+  // Render targets are where drivers gain the most from dedicated memory
+  // (compression metadata, tiling), so always honour the hint for them.
+  bool dedicated = dedicatedRequirements.prefersDedicatedAllocation ||
+                   (imageInfo.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT));
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    allocation = allocateLocked(requirements.memoryRequirements, properties,
+                                imageInfo.tiling == VK_IMAGE_TILING_LINEAR,
+                                dedicated, VK_NULL_HANDLE, image);
+  }
+
+  vkBindImageMemory(device.getDevice(), image, allocation.memory, allocation.offset);
+}
+
+void VulkanMemoryAllocator::destroyBuffer(VkBuffer buffer,
+                                          VulkanAllocation &allocation) {
+  vkDestroyBuffer(device.getDevice(), buffer, device.getAllocationCallbacks());
+  free(allocation);
+}
+
+void VulkanMemoryAllocator::destroyImage(VkImage image,
+                                         VulkanAllocation &allocation) {
+  vkDestroyImage(device.getDevice(), image, device.getAllocationCallbacks());
+  free(allocation);
+}
+
+VkDeviceSize VulkanMemoryAllocator::defragment(
+    const std::vector<VulkanAllocation *> &allocations, const MoveCallback &move) {
+  VkDeviceSize movedBytes = 0;
+
+  for (VulkanAllocation *allocation : allocations) {
+    VulkanMemoryBlock *source = allocation->block;
+    if (source == nullptr) continue;
+
+    // Reserved under the lock; both blocks then hold a node of this move
+    // and stay alive while move() runs without it.
+    VulkanAllocation target;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      // Only drain blocks that are at most a quarter full; moving out of
+      // busier blocks costs copies without freeing anything.
+      if (source->usedBytes > source->size / 4) continue;
+
+      // The current node size satisfies whatever alignment the resource had.
+      VkDeviceSize alignment =
+          source->size >> source->allocatedLevels.at(allocation->offset);
+
+      // Never move into another sparse block, or blocks just swap contents.
+      for (auto &block : pools[source->pool]) {
+        if (block.get() == source || block->usedBytes <= block->size / 4) continue;
+
+        VkDeviceSize offset;
+        if (block->allocate(allocation->size, alignment, offset)) {
+          target.memory = block->memory;
+          target.offset = offset;
+          target.mapped = block->mapped ? block->mapped + offset : nullptr;
+          target.block = block.get();
+          break;
+        }
+      }
+      if (target.block == nullptr) continue;
+    }
+
+    target.size = allocation->size;
+    target.memoryType = allocation->memoryType;
+    // Unlocked, so the callback can create the replacement resource, or
+    // anything else, through the allocator.
+    try {
+      move(*allocation, target);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      target.block->free(target.offset);
+      throw;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    source->free(allocation->offset);
+    *allocation = target;
+    movedBytes += target.size;
+
+    if (source->allocationCount == 0) {
+      releaseBlock(source);
+    }
+  }
+
+  return movedBytes;
+}
+
+std::vector<VulkanMemoryAllocator::HeapStats>
+VulkanMemoryAllocator::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::vector<HeapStats>(heapStats.begin(),
+                                heapStats.begin() + memoryProperties.memoryHeapCount);
+}
+
+void VulkanMemoryAllocator::updateBudget() {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+  budgetProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  if (device.hasMemoryBudget()) {
+    VkPhysicalDeviceMemoryProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &budgetProperties;
+    vkGetPhysicalDeviceMemoryProperties2(device.getPhysicalDevice(),
+                                         &properties);
+  }
+
+  std::vector<uint32_t> pressured;
+  std::vector<uint32_t> newlyPressured;
+  std::vector<std::pair<uint32_t, PressureCallback>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+      HeapBudget &budget = heapBudgets[heap];
+      if (device.hasMemoryBudget()) {
+        budget.usage = budgetProperties.heapUsage[heap];
+        budget.budget = budgetProperties.heapBudget[heap];
+        budget.estimated = false;
+      } else {
+        budget.usage = heapStats[heap].reservedBytes;
+        budget.budget = static_cast<VkDeviceSize>(
+            memoryProperties.memoryHeaps[heap].size * ESTIMATED_BUDGET_SHARE);
+        budget.estimated = true;
+      }
+
+      bool pressure = budget.usage > budget.budget * PRESSURE_THRESHOLD;
+      if (pressure && !underPressure[heap]) {
+        std::cerr << "Memory heap " << heap << " is under pressure: "
+                  << budget.usage << " of " << budget.budget
+                  << " budget bytes in use" << std::endl;
+        newlyPressured.push_back(heap);
+      }
+      underPressure[heap] = pressure;
+      if (pressure) {
+        pressured.push_back(heap);
+      }
+    }
+    if (!newlyPressured.empty()) {
+      callbacks = pressureCallbacks;
+    }
+  }
+
+  for (uint32_t heap : newlyPressured) {
+    HeapBudget budget = getBudget(heap);
+    for (const auto &callback : callbacks) {
+      callback.second(heap, budget);
+    }
+  }
+  for (uint32_t heap : pressured) {
+    trimEmptyBlocks(heap);
+  }
+}
+
+VulkanMemoryAllocator::HeapBudget
+VulkanMemoryAllocator::getBudget(uint32_t heap) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return heapBudgets[heap];
+}
+
+uint32_t VulkanMemoryAllocator::addPressureCallback(PressureCallback callback) {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint32_t id = nextCallbackId++;
+  pressureCallbacks.emplace_back(id, std::move(callback));
+  return id;
+}
+
+void VulkanMemoryAllocator::removePressureCallback(uint32_t id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  pressureCallbacks.erase(
+      std::remove_if(pressureCallbacks.begin(), pressureCallbacks.end(),
+                     [id](const std::pair<uint32_t, PressureCallback> &entry) {
+                       return entry.first == id;
+                     }),
+      pressureCallbacks.end());
+}
+
+VkDeviceSize VulkanMemoryAllocator::trimEmptyBlocks(uint32_t heap) {
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize released = 0;
+  for (uint32_t pool = 0; pool < pools.size(); pool++) {
+    if (heapOf(pool / 2) != heap) continue;
+
+    std::vector<const VulkanMemoryBlock *> empty;
+    for (const auto &block : pools[pool]) {
+      if (block->allocationCount == 0) {
+        empty.push_back(block.get());
+      }
+    }
+    for (const VulkanMemoryBlock *block : empty) {
+      released += block->size;
+      releaseBlock(block);
+    }
+  }
+  return released;
+}
+
+void VulkanMemoryAllocator::writeStats(std::ostream &out) const {
+  auto mib = [](VkDeviceSize bytes) { return bytes / (1024.0 * 1024.0); };
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(2);
+
+  std::vector<HeapStats> stats = getStats();
+  for (size_t heap = 0; heap < stats.size(); heap++) {
+    const HeapStats &heapStat = stats[heap];
+    HeapBudget budget = getBudget(static_cast<uint32_t>(heap));
+    out << "heap " << heap << " (" << mib(heapStat.heapSize) << " MiB): "
+        << heapStat.allocationCount << " allocations, "
+        << mib(heapStat.usedBytes) << " MiB used / "
+        << mib(heapStat.reservedBytes) << " MiB reserved in "
+        << heapStat.blockCount << " blocks + " << heapStat.dedicatedCount
+        << " dedicated, " << mib(budget.usage) << " of "
+        << mib(budget.budget) << " MiB budget"
+        << (budget.estimated ? " (estimated)" : "") << std::endl;
+  }
+
+  out.flags(flags);
+}
@@ -0,0 +1,162 @@
+#ifndef VULKAN_MEMORY_ALLOCATOR_H
+#define VULKAN_MEMORY_ALLOCATOR_H
+
+class VulkanDevice;
+struct VulkanMemoryBlock;
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// A range of device memory handed out by VulkanMemoryAllocator.
+struct VulkanAllocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // Host pointer to offset when the memory is HOST_VISIBLE, else nullptr.
+  void *mapped = nullptr;
+  uint32_t memoryType = 0;
+  // Owning block, or nullptr for a dedicated allocation.
+  VulkanMemoryBlock *block = nullptr;
+};
+
+// Sub-allocates resources out of large VkDeviceMemory blocks, so a scene
+// with thousands of buffers stays far below maxMemoryAllocationCount. Each
+// block is managed as a buddy allocator: ranges are rounded up to a power of
+// two, which keeps them naturally aligned and makes freeing O(log n).
+//
+// Buffers and optimally tiled images are kept in separate blocks whenever
+// bufferImageGranularity is larger than one byte, so the two never share a
+// granularity page. Large resources, and those the driver asks for, get a
+// dedicated allocation instead.
+class VulkanMemoryAllocator {
+public:
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+  static constexpr VkDeviceSize MIN_ALLOCATION_SIZE = 256;
+
+  struct HeapStats {
+    VkDeviceSize heapSize = 0;
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    uint32_t allocationCount = 0;
+    // Bytes requested by live allocations.
+    VkDeviceSize usedBytes = 0;
+    // Bytes obtained from vkAllocateMemory, blocks and dedicated alike.
+    VkDeviceSize reservedBytes = 0;
+  };
+
+  // Told to move a resource from one allocation to another during
+  // defragmentation. It must copy the contents and rebind the resource
+  // before returning; the old range is freed right afterwards. Runs without
+  // the allocator's lock held, so it may allocate through it.
+  using MoveCallback = std::function<void(const VulkanAllocation &from,
+                                          const VulkanAllocation &to)>;
+
+  // How much of a heap the process uses and may use. From
+  // VK_EXT_memory_budget when the device has it; otherwise usage is what
+  // this allocator reserved and the budget a fixed share of the heap.
+  struct HeapBudget {
+    VkDeviceSize usage = 0;
+    VkDeviceSize budget = 0;
+    bool estimated = true;
+  };
+
+  // Share of the budget beyond which a heap counts as under pressure.
+  static constexpr double PRESSURE_THRESHOLD = 0.9;
+  // Budget assumed without VK_EXT_memory_budget, as a share of the heap;
+  // drivers that report one rarely offer much more.
+  static constexpr double ESTIMATED_BUDGET_SHARE = 0.8;
+
+  // Called by the updateBudget() that finds a heap newly under pressure, so
+  // caches can free memory before the driver starts paging or failing
+  // allocations. Runs on the thread calling updateBudget(), without the
+  // allocator's lock held, and must not block on the GPU.
+  using PressureCallback =
+      std::function<void(uint32_t heap, const HeapBudget &budget)>;
+
+  VulkanMemoryAllocator(VulkanDevice &device);
+  ~VulkanMemoryAllocator();
+
+  VulkanMemoryAllocator(const VulkanMemoryAllocator &) = delete;
+  VulkanMemoryAllocator &operator=(const VulkanMemoryAllocator &) = delete;
+
+  void create();
+  void cleanup();
+
+  // linear is true for buffers and linearly tiled images.
+  VulkanAllocation allocate(const VkMemoryRequirements &requirements,
+                            VkMemoryPropertyFlags properties, bool linear,
+                            bool dedicated = false);
+  void free(VulkanAllocation &allocation);
+
+  // Create the resource, allocate memory for it and bind the two.
+  void createBuffer(const VkBufferCreateInfo &bufferInfo,
+                    VkMemoryPropertyFlags properties, VkBuffer &buffer,
+                    VulkanAllocation &allocation);
+  void createImage(const VkImageCreateInfo &imageInfo,
+                   VkMemoryPropertyFlags properties, VkImage &image,
+                   VulkanAllocation &allocation);
+  void destroyBuffer(VkBuffer buffer, VulkanAllocation &allocation);
+  void destroyImage(VkImage image, VulkanAllocation &allocation);
+
+  // Moves the given allocations out of sparsely used blocks into the free
+  // space of fuller ones and releases the blocks that end up empty. Only the
+  // allocations passed in are considered, so callers decide what is movable.
+  // Returns the number of bytes moved.
+  VkDeviceSize defragment(const std::vector<VulkanAllocation *> &allocations,
+                          const MoveCallback &move);
+
+  std::vector<HeapStats> getStats() const;
+  void writeStats(std::ostream &out) const;
+
+  // Re-reads every heap's usage and budget; meant to be called once per
+  // frame. On heaps that just came under pressure the pressure callbacks
+  // run first; then, on every heap under pressure, the empty blocks kept
+  // for churn are released, so blocks emptied by deferred frees go too.
+  void updateBudget();
+  HeapBudget getBudget(uint32_t heap) const;
+  // Returns an id for removePressureCallback().
+  uint32_t addPressureCallback(PressureCallback callback);
+  void removePressureCallback(uint32_t id);
+  // Frees the empty blocks of heap's pools; returns the bytes released.
+  VkDeviceSize trimEmptyBlocks(uint32_t heap);
+  uint32_t heapOf(uint32_t memoryType) const {
+    return memoryProperties.memoryTypes[memoryType].heapIndex;
+  }
+
+private:
+  VulkanDevice &device;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+  VkDeviceSize bufferImageGranularity = 1;
+
+  mutable std::mutex mutex;
+  // Indexed by memory type * 2 + (linear ? 0 : 1).
+  std::vector<std::vector<std::unique_ptr<VulkanMemoryBlock>>> pools;
+  std::array<HeapStats, VK_MAX_MEMORY_HEAPS> heapStats{};
+  std::array<HeapBudget, VK_MAX_MEMORY_HEAPS> heapBudgets{};
+  std::array<bool, VK_MAX_MEMORY_HEAPS> underPressure{};
+
+  std::vector<std::pair<uint32_t, PressureCallback>> pressureCallbacks;
+  uint32_t nextCallbackId = 0;
+
+  uint32_t poolIndex(uint32_t memoryType, bool linear) const;
+  VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+  VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                const void *next, void **mapped);
+  bool allocateFromPool(uint32_t pool, const VkMemoryRequirements &requirements,
+                        VulkanAllocation &allocation);
+  VulkanAllocation allocateDedicated(const VkMemoryRequirements &requirements,
+                                     uint32_t memoryType, VkBuffer buffer,
+                                     VkImage image);
+  VulkanAllocation allocateLocked(const VkMemoryRequirements &requirements,
+                                  VkMemoryPropertyFlags properties, bool linear,
+                                  bool dedicated, VkBuffer buffer, VkImage image);
+  void freeLocked(VulkanAllocation &allocation);
+  void releaseBlock(const VulkanMemoryBlock *block);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "VulkanMeshBuffer.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const std::vector<VulkanMeshBuffer::Vertex> triangleVertices = {
+    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+};
+
+} // namespace
+
+VulkanMeshBuffer::VulkanMeshBuffer(VulkanDevice &device) : device(device) {}
+
+void VulkanMeshBuffer::create() {
+  const Scene &scene = device.getConfig().scene;
+  layout = scene.vertexLayout;
+
+  // Draws of more than one triangle stack copies of the same triangle.
+  std::vector<uint16_t> indices;
+  indices.reserve(size_t(scene.trianglesPerDraw) * 3);
+  for (uint32_t i = 0; i < scene.trianglesPerDraw; i++) {
+    indices.insert(indices.end(), {0, 1, 2});
+  }
+  indexCount = static_cast<uint32_t>(indices.size());
+
+  boundingRadius = 0.0f;
+  for (const Vertex &vertex : triangleVertices) {
+    boundingRadius = std::max(boundingRadius, std::hypot(vertex.position[0],
+                                                         vertex.position[1]));
+  }
+
+  std::vector<char> vertexData;
+  if (layout == Scene::INTERLEAVED) {
+    vertexData.resize(triangleVertices.size() * sizeof(Vertex));
+    std::memcpy(vertexData.data(), triangleVertices.data(), vertexData.size());
+    streamOffsets = {0};
+  } else {
+    size_t positionsSize = triangleVertices.size() * sizeof(Vertex::position);
+    size_t colorsSize = triangleVertices.size() * sizeof(Vertex::color);
+    vertexData.resize(positionsSize + colorsSize);
+    for (size_t i = 0; i < triangleVertices.size(); i++) {
+      std::memcpy(vertexData.data() + i * sizeof(Vertex::position),
+                  triangleVertices[i].position, sizeof(Vertex::position));
+      std::memcpy(vertexData.data() + positionsSize + i * sizeof(Vertex::color),
+                  triangleVertices[i].color, sizeof(Vertex::color));
+    }
+    streamOffsets = {0, positionsSize};
+  }
+
+  VkDeviceSize indexSize = indices.size() * sizeof(uint16_t);
+
+  device.createBuffer(vertexData.size(),
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer,
+                      vertexAllocation);
+  device.createBuffer(indexSize,
+                      VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer,
+                      indexAllocation);
+
+  VulkanStagingRing &stagingRing = device.getStagingRing();
+  stagingRing.upload(vertexBuffer, 0, vertexData.data(), vertexData.size());
+  stagingRing.upload(indexBuffer, 0, indices.data(), indexSize);
+  stagingRing.flush();
+}
+
+void VulkanMeshBuffer::cleanup() {
+  VulkanMemoryAllocator &allocator = device.getMemoryAllocator();
+  allocator.destroyBuffer(indexBuffer, indexAllocation);
+  allocator.destroyBuffer(vertexBuffer, vertexAllocation);
+  indexBuffer = VK_NULL_HANDLE;
+  vertexBuffer = VK_NULL_HANDLE;
+  streamOffsets.clear();
+}
+
+void VulkanMeshBuffer::bind(VkCommandBuffer commandBuffer) const {
+  std::vector<VkBuffer> buffers(streamOffsets.size(), vertexBuffer);
+  vkCmdBindVertexBuffers(commandBuffer, 0,
+                         static_cast<uint32_t>(buffers.size()), buffers.data(),
+                         streamOffsets.data());
+  vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+std::vector<VkVertexInputBindingDescription>
+VulkanMeshBuffer::getBindingDescriptions(Scene::VertexLayout layout) {
+  if (layout == Scene::INTERLEAVED) {
+    return {{0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+  }
+  return {{0, sizeof(Vertex::position), VK_VERTEX_INPUT_RATE_VERTEX},
+          {1, sizeof(Vertex::color), VK_VERTEX_INPUT_RATE_VERTEX}};
+}
+
+std::vector<VkVertexInputAttributeDescription>
+VulkanMeshBuffer::getAttributeDescriptions(Scene::VertexLayout layout) {
+  if (layout == Scene::INTERLEAVED) {
+    return {{0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, position)},
+            {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color)}};
+  }
+  return {{0, 0, VK_FORMAT_R32G32_SFLOAT, 0},
+          {1, 1, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+}
@@ -0,0 +1,54 @@
+#ifndef VULKAN_MESH_BUFFER_H
+#define VULKAN_MESH_BUFFER_H
+
+class VulkanDevice;
+#include "Scene.h"
+#include "VulkanMemoryAllocator.h"
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Vertex and index data of the scene, uploaded once through the staging ring
+// into DEVICE_LOCAL buffers. Both vertex layouts live in a single buffer:
+// split streams are bound as two ranges of it.
+class VulkanMeshBuffer {
+public:
+  struct Vertex {
+    float position[2];
+    float color[3];
+  };
+
+  VulkanMeshBuffer(VulkanDevice &device);
+
+  VulkanMeshBuffer(const VulkanMeshBuffer &) = delete;
+  VulkanMeshBuffer &operator=(const VulkanMeshBuffer &) = delete;
+
+  void create();
+  void cleanup();
+
+  // Binds the vertex streams and the index buffer for vkCmdDrawIndexed.
+  void bind(VkCommandBuffer commandBuffer) const;
+  uint32_t getIndexCount() const { return indexCount; }
+  // Radius of a sphere around the origin that contains every vertex.
+  float getBoundingRadius() const { return boundingRadius; }
+
+  static std::vector<VkVertexInputBindingDescription>
+  getBindingDescriptions(Scene::VertexLayout layout);
+  static std::vector<VkVertexInputAttributeDescription>
+  getAttributeDescriptions(Scene::VertexLayout layout);
+
+private:
+  VulkanDevice &device;
+  Scene::VertexLayout layout = Scene::INTERLEAVED;
+
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  VulkanAllocation vertexAllocation;
+  // Byte offset of every stream within vertexBuffer, one per binding.
+  std::vector<VkDeviceSize> streamOffsets;
+
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  VulkanAllocation indexAllocation;
+  uint32_t indexCount = 0;
+  float boundingRadius = 0.0f;
+};
+
+#endif
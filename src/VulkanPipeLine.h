@@ -2,30 +2,54 @@
 #define VULKAN_PIPE_LINE_H
 
 class VulkanDevice;
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 
 class VulkanPipeLine {
 public:
+  // Per-frame block read through the uniform ring's dynamic descriptor.
+  struct FrameData {
+    float tint[4];
+  };
+
+  // Per-draw push constants; the default leaves the triangle in place.
+  struct DrawConstants {
+    float offset[2] = {0.0f, 0.0f};
+    float scale = 1.0f;
+    // Length of each stream in the instance buffer.
+    uint32_t instanceCount = 1;
+  };
 
   VulkanPipeLine(VulkanDevice &device); 
 
+  // Compiles the first pipeline and queues the remaining variants with the
+  // pipeline manager.
   void createGraphicsPipeline();
+  // Swaps in the variants the manager finished since the last call; true
+  // when any pipeline handle changed. Call before recording a frame.
+  bool refreshPipelines();
   void createRenderPass();
   void cleanup();
 
   VkRenderPass getRenderPass() const { return renderPass; }
-  VkPipeline getGraphicsPipeline() const { return graphicsPipeline; }
+  VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
+  VkPipeline getGraphicsPipeline(uint32_t index = 0) const { return graphicsPipelines[index]; }
+  uint32_t getPipelineCount() const { return static_cast<uint32_t>(graphicsPipelines.size()); }
 
 private:
-
-  VkShaderModule createShaderModule(const std::vector<char>& code);
-
   VulkanDevice &device;
-  VkRenderPass renderPass;
+  // VK_NULL_HANDLE with dynamic rendering.
+  VkRenderPass renderPass = VK_NULL_HANDLE;
   VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
+  // Scene::pipelineCount variants of one state, so draws can exercise
+  // pipeline switches; index 0 is the one a single-pipeline scene uses.
+  // Variants still compiling hold fallbackPipeline.
+  std::vector<VkPipeline> graphicsPipelines;
+  std::vector<uint64_t> pipelineKeys;
+  VkPipeline fallbackPipeline = VK_NULL_HANDLE;
+  uint64_t seenGeneration = UINT64_MAX;
 };
 
 #endif
@@ -0,0 +1,137 @@
+#include "VulkanPipeLineCache.h"
+#include "VulkanDevice.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+VulkanPipeLineCache::VulkanPipeLineCache(VulkanDevice &device)
+    : device(device) {}
+
+void VulkanPipeLineCache::create(const std::string &path) {
+  this->path = path;
+  loadedData = loadFromDisk();
+
+  if (!loadedData.empty() && !isCompatible(loadedData)) {
+    loadedData.clear();
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo{};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = loadedData.size();
+  cacheInfo.pInitialData = loadedData.empty() ? nullptr : loadedData.data();
+
+  if (vkCreatePipelineCache(device.getDevice(), &cacheInfo,
+                            device.getAllocationCallbacks(),
+                            &pipelineCache) == VK_SUCCESS) {
+    return;
+  }
+
+  // Drivers may still refuse data that passed the header checks; starting
+  // from an empty cache is always allowed.
+  std::cerr << "Pipeline cache " << path << " rejected by the driver, starting empty" << std::endl;
+  loadedData.clear();
+  cacheInfo.initialDataSize = 0;
+  cacheInfo.pInitialData = nullptr;
+
+  if (vkCreatePipelineCache(device.getDevice(), &cacheInfo,
+                            device.getAllocationCallbacks(),
+                            &pipelineCache) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache!");
+  }
+}
+
+std::vector<char> VulkanPipeLineCache::loadFromDisk() {
+  if (path.empty()) return {};
+
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open()) return {};
+
+  size_t fileSize = (size_t)file.tellg();
+  std::vector<char> buffer(fileSize);
+
+  file.seekg(0);
+  file.read(buffer.data(), fileSize);
+  if (!file) return {};
+
+  return buffer;
+}
+
+bool VulkanPipeLineCache::isCompatible(const std::vector<char> &data) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    std::cerr << "Pipeline cache " << path << " is truncated, ignoring it" << std::endl;
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+
+  if (header.headerSize < sizeof(header) || header.headerSize > data.size() ||
+      header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    std::cerr << "Pipeline cache " << path << " has an unknown header, ignoring it" << std::endl;
+    return false;
+  }
+
+  if (header.vendorID != properties.vendorID ||
+      header.deviceID != properties.deviceID ||
+      std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                  VK_UUID_SIZE) != 0) {
+    std::cerr << "Pipeline cache " << path << " was written by another device or driver, ignoring it" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void VulkanPipeLineCache::save() {
+  if (path.empty() || pipelineCache == VK_NULL_HANDLE) return;
+
+  size_t dataSize = 0;
+  if (vkGetPipelineCacheData(device.getDevice(), pipelineCache, &dataSize,
+                             nullptr) != VK_SUCCESS) {
+    std::cerr << "Failed to query pipeline cache size" << std::endl;
+    return;
+  }
+
+  std::vector<char> data(dataSize);
+  if (vkGetPipelineCacheData(device.getDevice(), pipelineCache, &dataSize,
+                             data.data()) != VK_SUCCESS) {
+    std::cerr << "Failed to read back pipeline cache" << std::endl;
+    return;
+  }
+  data.resize(dataSize);
+
+  if (data == loadedData) return;
+
+  // Write next to the target and rename over it, so a crash mid-write never
+  // leaves a torn cache behind for the next launch.
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if (!file) {
+      std::cerr << "Failed to write pipeline cache " << tmpPath << std::endl;
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cerr << "Failed to replace pipeline cache " << path << std::endl;
+    std::remove(tmpPath.c_str());
+    return;
+  }
+
+  loadedData = std::move(data);
+}
+
+void VulkanPipeLineCache::cleanup() {
+  save();
+  vkDestroyPipelineCache(device.getDevice(), pipelineCache,
+                         device.getAllocationCallbacks());
+  pipelineCache = VK_NULL_HANDLE;
+}
@@ -0,0 +1,35 @@
+#ifndef VULKAN_PIPE_LINE_CACHE_H
+#define VULKAN_PIPE_LINE_CACHE_H
+
+class VulkanDevice;
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Wraps a VkPipelineCache that is seeded from disk at startup and written
+// back on cleanup, so pipelines compiled in one run are reused by the next.
+class VulkanPipeLineCache {
+public:
+  VulkanPipeLineCache(VulkanDevice &device);
+
+  VulkanPipeLineCache(const VulkanPipeLineCache &) = delete;
+  VulkanPipeLineCache &operator=(const VulkanPipeLineCache &) = delete;
+
+  // An empty path keeps the cache in memory only.
+  void create(const std::string &path);
+  void save();
+  void cleanup();
+
+  VkPipelineCache getCache() const { return pipelineCache; }
+
+private:
+  VulkanDevice &device;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  std::string path;
+  std::vector<char> loadedData;
+
+  std::vector<char> loadFromDisk();
+  bool isCompatible(const std::vector<char> &data);
+};
+
+#endif
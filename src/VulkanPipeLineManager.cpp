@@ -0,0 +1,386 @@
+#include "VulkanPipeLineManager.h"
+#include "VulkanDevice.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// FNV-1a: cheap, and keys are only computed when a state is requested.
+constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+void hashBytes(uint64_t &hash, const void *data, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+template <typename T> void hashValue(uint64_t &hash, const T &value) {
+  hashBytes(hash, &value, sizeof(value));
+}
+
+bool sameCode(const VulkanPipeLineManager::ShaderCode &a,
+              const VulkanPipeLineManager::ShaderCode &b) {
+  return a.size == b.size &&
+         (a.code == b.code || std::memcmp(a.code, b.code, a.size) == 0);
+}
+
+} // namespace
+
+uint64_t VulkanPipeLineManager::PipelineState::hash() const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  hashValue(hash, vertexShader.size);
+  hashBytes(hash, vertexShader.code, vertexShader.size);
+  hashValue(hash, fragmentShader.size);
+  hashBytes(hash, fragmentShader.code, fragmentShader.size);
+  hashValue(hash, specializationConstants.size());
+  hashBytes(hash, specializationConstants.data(),
+            specializationConstants.size() * sizeof(uint32_t));
+  hashValue(hash, vertexLayout);
+  hashValue(hash, topology);
+  hashValue(hash, polygonMode);
+  hashValue(hash, cullMode);
+  hashValue(hash, frontFace);
+  hashValue(hash, blendEnable);
+  hashValue(hash, srcColorBlendFactor);
+  hashValue(hash, dstColorBlendFactor);
+  hashValue(hash, layout);
+  hashValue(hash, renderPass);
+  hashValue(hash, colorFormat);
+  return hash;
+}
+
+bool VulkanPipeLineManager::PipelineState::operator==(
+    const PipelineState &other) const {
+  return sameCode(vertexShader, other.vertexShader) &&
+         sameCode(fragmentShader, other.fragmentShader) &&
+         specializationConstants == other.specializationConstants &&
+         vertexLayout == other.vertexLayout && topology == other.topology &&
+         polygonMode == other.polygonMode && cullMode == other.cullMode &&
+         frontFace == other.frontFace && blendEnable == other.blendEnable &&
+         srcColorBlendFactor == other.srcColorBlendFactor &&
+         dstColorBlendFactor == other.dstColorBlendFactor &&
+         layout == other.layout && renderPass == other.renderPass &&
+         colorFormat == other.colorFormat;
+}
+
+VulkanPipeLineManager::VulkanPipeLineManager(VulkanDevice &device)
+    : device(device) {}
+
+void VulkanPipeLineManager::create(uint32_t threadCount) {
+  stopping = false;
+  workers.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++) {
+    workers.emplace_back(&VulkanPipeLineManager::workerLoop, this);
+  }
+}
+
+void VulkanPipeLineManager::cleanup() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    // Nobody is left to draw with what has not started compiling yet.
+    for (uint64_t key : queue) {
+      entries.erase(key);
+    }
+    pending -= static_cast<uint32_t>(queue.size());
+    queue.clear();
+  }
+  wake.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+
+  for (auto &entry : entries) {
+    if (entry.second.pipeline != VK_NULL_HANDLE) {
+      vkDestroyPipeline(device.getDevice(), entry.second.pipeline,
+                        device.getAllocationCallbacks());
+    }
+  }
+  entries.clear();
+}
+
+bool VulkanPipeLineManager::insert(const PipelineState &state, uint64_t &key) {
+  key = state.hash();
+
+  auto existing = entries.find(key);
+  if (existing != entries.end()) {
+    if (!(existing->second.state == state)) {
+      throw std::runtime_error("pipeline state hash collision!");
+    }
+    return false;
+  }
+
+  Entry entry;
+  entry.state = state;
+  entries.emplace(key, std::move(entry));
+  pending++;
+  return true;
+}
+
+uint64_t VulkanPipeLineManager::request(const PipelineState &state) {
+  uint64_t key;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!insert(state, key)) {
+      return key;
+    }
+    if (!workers.empty()) {
+      queue.push_back(key);
+      wake.notify_one();
+      return key;
+    }
+  }
+
+  build(key, state);
+  return key;
+}
+
+VkPipeline VulkanPipeLineManager::compile(const PipelineState &state) {
+  uint64_t key;
+  bool inserted;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    inserted = insert(state, key);
+  }
+  if (inserted) {
+    build(key, state);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return entries.at(key).done; });
+  if (entries.at(key).failed) {
+    throw std::runtime_error("failed to create graphics pipeline!");
+  }
+  return entries.at(key).pipeline;
+}
+
+VkPipeline VulkanPipeLineManager::find(uint64_t key) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const Entry &entry = entries.at(key);
+  if (entry.failed) {
+    throw std::runtime_error("failed to create graphics pipeline!");
+  }
+  return entry.pipeline;
+}
+
+void VulkanPipeLineManager::waitIdle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [this] { return pending == 0; });
+}
+
+uint32_t VulkanPipeLineManager::getPendingCount() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending;
+}
+
+void VulkanPipeLineManager::workerLoop() {
+  while (true) {
+    uint64_t key;
+    PipelineState state;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (stopping) return;
+      key = queue.front();
+      queue.pop_front();
+      state = entries.at(key).state;
+    }
+
+    build(key, state);
+  }
+}
+
+void VulkanPipeLineManager::build(uint64_t key, const PipelineState &state) {
+  // Failures are reported to whoever looks the pipeline up, not on the
+  // worker that happened to compile it.
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  bool failed = false;
+  try {
+    pipeline = createPipeline(state);
+  } catch (const std::exception &) {
+    failed = true;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries.at(key);
+    entry.pipeline = pipeline;
+    entry.done = true;
+    entry.failed = failed;
+    pending--;
+  }
+  generation++;
+  finished.notify_all();
+}
+
+VkShaderModule
+VulkanPipeLineManager::createShaderModule(const ShaderCode &code) const {
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = code.size;
+  createInfo.pCode = code.code;
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device.getDevice(), &createInfo,
+                           device.getAllocationCallbacks(),
+                           &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create shader module!");
+  }
+  return shaderModule;
+}
+
+VkPipeline
+VulkanPipeLineManager::createPipeline(const PipelineState &state) const {
+  std::vector<VkSpecializationMapEntry> mapEntries(
+      state.specializationConstants.size());
+  for (uint32_t i = 0; i < mapEntries.size(); i++) {
+    mapEntries[i].constantID = i;
+    mapEntries[i].offset = i * sizeof(uint32_t);
+    mapEntries[i].size = sizeof(uint32_t);
+  }
+
+  VkSpecializationInfo specialization{};
+  specialization.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+  specialization.pMapEntries = mapEntries.data();
+  specialization.dataSize =
+      state.specializationConstants.size() * sizeof(uint32_t);
+  specialization.pData = state.specializationConstants.data();
+
+  VkShaderModule vertShaderModule = createShaderModule(state.vertexShader);
+  VkShaderModule fragShaderModule;
+  try {
+    fragShaderModule = createShaderModule(state.fragmentShader);
+  } catch (...) {
+    // Workers keep running after a failed variant; leak nothing.
+    vkDestroyShaderModule(device.getDevice(), vertShaderModule,
+                          device.getAllocationCallbacks());
+    throw;
+  }
+
+  VkPipelineShaderStageCreateInfo shaderStages[2]{};
+  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = vertShaderModule;
+  shaderStages[0].pName = "main";
+  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  shaderStages[1].module = fragShaderModule;
+  shaderStages[1].pName = "main";
+  if (!mapEntries.empty()) {
+    shaderStages[0].pSpecializationInfo = &specialization;
+    shaderStages[1].pSpecializationInfo = &specialization;
+  }
+
+  std::vector<VkDynamicState> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT,
+                                               VK_DYNAMIC_STATE_SCISSOR};
+
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+  dynamicState.pDynamicStates = dynamicStates.data();
+
+  auto bindingDescriptions =
+      VulkanMeshBuffer::getBindingDescriptions(state.vertexLayout);
+  auto attributeDescriptions =
+      VulkanMeshBuffer::getAttributeDescriptions(state.vertexLayout);
+
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+  vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(bindingDescriptions.size());
+  vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+  vertexInputInfo.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(attributeDescriptions.size());
+  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = state.topology;
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  // Both are dynamic, only the counts matter.
+  VkPipelineViewportStateCreateInfo viewportState{};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  rasterizer.polygonMode = state.polygonMode;
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = state.cullMode;
+  rasterizer.frontFace = state.frontFace;
+  rasterizer.depthBiasEnable = VK_FALSE;
+
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  multisampling.minSampleShading = 1.0f;
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+  colorBlendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable = state.blendEnable ? VK_TRUE : VK_FALSE;
+  colorBlendAttachment.srcColorBlendFactor = state.srcColorBlendFactor;
+  colorBlendAttachment.dstColorBlendFactor = state.dstColorBlendFactor;
+  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  VkPipelineColorBlendStateCreateInfo colorBlending{};
+  colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.logicOpEnable = VK_FALSE;
+  colorBlending.logicOp = VK_LOGIC_OP_COPY;
+  colorBlending.attachmentCount = 1;
+  colorBlending.pAttachments = &colorBlendAttachment;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2;
+  pipelineInfo.pStages = shaderStages;
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pDepthStencilState = nullptr;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = state.layout;
+  pipelineInfo.renderPass = state.renderPass;
+  pipelineInfo.subpass = 0;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+
+  // Without a render pass the pipeline names its attachment formats itself.
+  VkPipelineRenderingCreateInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &state.colorFormat;
+  if (state.renderPass == VK_NULL_HANDLE) {
+    pipelineInfo.pNext = &renderingInfo;
+  }
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateGraphicsPipelines(
+      device.getDevice(), device.getPipeLineCache().getCache(), 1,
+      &pipelineInfo, device.getAllocationCallbacks(), &pipeline);
+
+  vkDestroyShaderModule(device.getDevice(), fragShaderModule,
+                        device.getAllocationCallbacks());
+  vkDestroyShaderModule(device.getDevice(), vertShaderModule,
+                        device.getAllocationCallbacks());
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create graphics pipeline!");
+  }
+  return pipeline;
+}
@@ -0,0 +1,113 @@
+#ifndef VULKAN_PIPE_LINE_MANAGER_H
+#define VULKAN_PIPE_LINE_MANAGER_H
+
+class VulkanDevice;
+#include "Scene.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Compiles graphics pipelines on background threads, keyed by a hash of their
+// full state, so a new state combination never stalls the thread that asked
+// for it.
+//
+// request() queues a state and returns its key straight away; find() hands
+// out the pipeline once a worker has built it and VK_NULL_HANDLE until then,
+// in which case callers draw with a fallback they compiled up front with
+// compile(). Workers call vkCreateGraphicsPipelines in parallel against the
+// shared, internally synchronized pipeline cache. getGeneration() changes
+// whenever a background compile finishes, so callers only look again when
+// something is new.
+class VulkanPipeLineManager {
+public:
+  // SPIR-V words; size is in bytes, as VkShaderModuleCreateInfo expects.
+  struct ShaderCode {
+    const uint32_t *code = nullptr;
+    size_t size = 0;
+  };
+
+  // Everything a pipeline is built from. Viewport and scissor are always
+  // dynamic.
+  struct PipelineState {
+    ShaderCode vertexShader;
+    ShaderCode fragmentShader;
+    // Values of constant_id 0, 1, ... in both stages.
+    std::vector<uint32_t> specializationConstants;
+    Scene::VertexLayout vertexLayout = Scene::INTERLEAVED;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_CLOCKWISE;
+    bool blendEnable = true;
+    VkBlendFactor srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    VkBlendFactor dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    // VK_NULL_HANDLE with dynamic rendering, which renders to colorFormat.
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+
+    uint64_t hash() const;
+    bool operator==(const PipelineState &other) const;
+  };
+
+  VulkanPipeLineManager(VulkanDevice &device);
+
+  VulkanPipeLineManager(const VulkanPipeLineManager &) = delete;
+  VulkanPipeLineManager &operator=(const VulkanPipeLineManager &) = delete;
+
+  // threadCount workers compile in the background; with none, request()
+  // compiles on the spot.
+  void create(uint32_t threadCount);
+  // Lets the workers finish what they started and destroys every pipeline.
+  void cleanup();
+
+  // Queues state for compilation unless it is known already.
+  uint64_t request(const PipelineState &state);
+  // Compiles state on the calling thread, unless it is known already, and
+  // waits for it either way.
+  VkPipeline compile(const PipelineState &state);
+  // The pipeline for key, or VK_NULL_HANDLE while it is still compiling.
+  // Throws if compiling it failed.
+  VkPipeline find(uint64_t key) const;
+  // Blocks until every requested pipeline is compiled.
+  void waitIdle();
+
+  uint64_t getGeneration() const { return generation.load(); }
+  uint32_t getPendingCount() const;
+
+private:
+  struct Entry {
+    PipelineState state;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    bool done = false;
+    bool failed = false;
+  };
+
+  VulkanDevice &device;
+
+  std::vector<std::thread> workers;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  std::deque<uint64_t> queue;
+  std::unordered_map<uint64_t, Entry> entries;
+  uint32_t pending = 0;
+  bool stopping = false;
+  std::atomic<uint64_t> generation{0};
+
+  // Adds state under its key; false when it was there already.
+  bool insert(const PipelineState &state, uint64_t &key);
+  void workerLoop();
+  // Compiles on the calling thread and publishes the result.
+  void build(uint64_t key, const PipelineState &state);
+  VkPipeline createPipeline(const PipelineState &state) const;
+  VkShaderModule createShaderModule(const ShaderCode &code) const;
+};
+
+#endif
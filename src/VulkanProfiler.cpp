@@ -0,0 +1,293 @@
+#include "VulkanProfiler.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+const std::array<const char *, VulkanProfiler::STATISTIC_COUNT>
+    VulkanProfiler::statisticNames = {
+        "input_assembly_vertices", "input_assembly_primitives",
+        "vertex_shader_invocations", "clipping_primitives",
+        "fragment_shader_invocations"};
+
+static constexpr VkQueryPipelineStatisticFlags pipelineStatisticFlags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+VulkanProfiler::VulkanProfiler(VulkanDevice &device) : device(device) {}
+
+VkQueryPipelineStatisticFlags VulkanProfiler::getInheritedStatistics() const {
+  return statisticsPools.empty() ? 0 : pipelineStatisticFlags;
+}
+
+void VulkanProfiler::create(uint32_t framesInFlight, bool pipelineStatistics) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+
+  uint32_t graphicsFamily =
+      device.findQueueFamilies(device.getPhysicalDevice()).graphicsFamily.value();
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device.getPhysicalDevice(),
+                                           &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(device.getPhysicalDevice(),
+                                           &queueFamilyCount,
+                                           queueFamilies.data());
+
+  uint32_t validBits = queueFamilies[graphicsFamily].timestampValidBits;
+  if (validBits == 0) {
+    std::cerr << "GPU profiling disabled: the graphics queue does not support timestamps" << std::endl;
+    return;
+  }
+  timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  timestampPeriodNs = properties.limits.timestampPeriod;
+
+  if (pipelineStatistics && !device.getEnabledFeatures().pipelineStatisticsQuery) {
+    std::cerr << "Pipeline statistics are not supported by this device, collecting timestamps only" << std::endl;
+    pipelineStatistics = false;
+  }
+  if (pipelineStatistics &&
+      (device.getConfig().recordThreads > 0 ||
+       device.getConfig().cacheCommandBuffers) &&
+      !device.getEnabledFeatures().inheritedQueries) {
+    std::cerr << "Pipeline statistics cannot span secondary command buffers on this device, collecting timestamps only" << std::endl;
+    pipelineStatistics = false;
+  }
+
+  timestampPools.resize(framesInFlight);
+  frameScopes.resize(framesInFlight);
+  if (pipelineStatistics) {
+    statisticsPools.resize(framesInFlight);
+  }
+
+  for (uint32_t i = 0; i < framesInFlight; i++) {
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_SCOPES * 2;
+
+    if (vkCreateQueryPool(device.getDevice(), &poolInfo,
+                          device.getAllocationCallbacks(),
+                          &timestampPools[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    if (!pipelineStatistics) continue;
+
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.queryCount = MAX_SCOPES;
+    poolInfo.pipelineStatistics = pipelineStatisticFlags;
+
+    if (vkCreateQueryPool(device.getDevice(), &poolInfo,
+                          device.getAllocationCallbacks(),
+                          &statisticsPools[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline statistics query pool!");
+    }
+  }
+}
+
+void VulkanProfiler::cleanup() {
+  for (auto pool : timestampPools) {
+    vkDestroyQueryPool(device.getDevice(), pool,
+                       device.getAllocationCallbacks());
+  }
+  for (auto pool : statisticsPools) {
+    vkDestroyQueryPool(device.getDevice(), pool,
+                       device.getAllocationCallbacks());
+  }
+  timestampPools.clear();
+  statisticsPools.clear();
+  frameScopes.clear();
+}
+
+void VulkanProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frame) {
+  if (!isEnabled()) return;
+
+  collect(frame);
+  currentFrame = frame;
+
+  vkCmdResetQueryPool(commandBuffer, timestampPools[frame], 0, MAX_SCOPES * 2);
+  if (!statisticsPools.empty()) {
+    vkCmdResetQueryPool(commandBuffer, statisticsPools[frame], 0, MAX_SCOPES);
+  }
+}
+
+uint32_t VulkanProfiler::beginScope(VkCommandBuffer commandBuffer,
+                                    const char *name) {
+  if (!isEnabled()) return 0;
+
+  auto &recorded = frameScopes[currentFrame];
+  if (recorded.size() == MAX_SCOPES) {
+    throw std::runtime_error("too many profiler scopes in one frame!");
+  }
+
+  uint32_t query = static_cast<uint32_t>(recorded.size());
+  recorded.push_back(findScope(name));
+
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      timestampPools[currentFrame], query * 2);
+  if (!statisticsPools.empty()) {
+    vkCmdBeginQuery(commandBuffer, statisticsPools[currentFrame], query, 0);
+  }
+
+  return query;
+}
+
+void VulkanProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+  if (!isEnabled()) return;
+
+  if (!statisticsPools.empty()) {
+    vkCmdEndQuery(commandBuffer, statisticsPools[currentFrame], scope);
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      timestampPools[currentFrame], scope * 2 + 1);
+}
+
+uint32_t VulkanProfiler::findScope(const char *name) {
+  for (uint32_t i = 0; i < scopes.size(); i++) {
+    if (scopes[i].name == name) return i;
+  }
+  scopes.push_back(ScopeHistory{name, {}, 0, {}});
+  return static_cast<uint32_t>(scopes.size() - 1);
+}
+
+void VulkanProfiler::collect(uint32_t frame) {
+  auto &recorded = frameScopes[frame];
+  if (recorded.empty()) return;
+
+  uint32_t queryCount = static_cast<uint32_t>(recorded.size());
+
+  // Each query is followed by its availability word. Nothing here waits: by
+  // the time a frame slot is reused its submission has completed, and anything
+  // still unavailable is simply dropped.
+  std::vector<uint64_t> timestamps(queryCount * 2 * 2);
+  VkResult result = vkGetQueryPoolResults(
+      device.getDevice(), timestampPools[frame], 0, queryCount * 2,
+      timestamps.size() * sizeof(uint64_t), timestamps.data(),
+      2 * sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+  std::vector<uint64_t> statistics;
+  const size_t statisticsStride = STATISTIC_COUNT + 1;
+  if (!statisticsPools.empty()) {
+    statistics.resize(queryCount * statisticsStride);
+    vkGetQueryPoolResults(
+        device.getDevice(), statisticsPools[frame], 0, queryCount,
+        statistics.size() * sizeof(uint64_t), statistics.data(),
+        statisticsStride * sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  }
+
+  if (result != VK_SUCCESS && result != VK_NOT_READY) {
+    recorded.clear();
+    return;
+  }
+
+  for (uint32_t i = 0; i < queryCount; i++) {
+    const uint64_t *begin = &timestamps[i * 4];
+    const uint64_t *end = &timestamps[i * 4 + 2];
+    if (begin[1] == 0 || end[1] == 0) continue;
+
+    uint64_t ticks = ((end[0] & timestampMask) - (begin[0] & timestampMask)) &
+                     timestampMask;
+    double ms = ticks * timestampPeriodNs / 1e6;
+
+    ScopeHistory &history = scopes[recorded[i]];
+    if (history.samplesMs.size() < HISTORY_SIZE) {
+      history.samplesMs.push_back(ms);
+    } else {
+      history.samplesMs[history.next] = ms;
+    }
+    history.next = (history.next + 1) % HISTORY_SIZE;
+
+    if (!statistics.empty() && statistics[i * statisticsStride + STATISTIC_COUNT] != 0) {
+      std::memcpy(history.statistics.data(), &statistics[i * statisticsStride],
+                  STATISTIC_COUNT * sizeof(uint64_t));
+    }
+  }
+
+  recorded.clear();
+}
+
+std::vector<VulkanProfiler::ScopeStats> VulkanProfiler::getStats() const {
+  std::vector<ScopeStats> stats;
+
+  for (const auto &history : scopes) {
+    ScopeStats scope{history.name, history.samplesMs.size(), 0.0, 0.0, 0.0,
+                     history.statistics};
+
+    if (!history.samplesMs.empty()) {
+      std::vector<double> sorted = history.samplesMs;
+      std::sort(sorted.begin(), sorted.end());
+
+      double sum = 0.0;
+      for (double sample : sorted) sum += sample;
+
+      size_t p99Index = (sorted.size() * 99 + 99) / 100 - 1;
+      scope.minMs = sorted.front();
+      scope.avgMs = sum / sorted.size();
+      scope.p99Ms = sorted[std::min(p99Index, sorted.size() - 1)];
+    }
+
+    stats.push_back(scope);
+  }
+
+  return stats;
+}
+
+void VulkanProfiler::resetStats() {
+  for (auto &history : scopes) {
+    history.samplesMs.clear();
+    history.next = 0;
+    history.statistics = {};
+  }
+}
+
+void VulkanProfiler::writeCsv(std::ostream &out) const {
+  out << "scope,samples,min_ms,avg_ms,p99_ms";
+  if (!statisticsPools.empty()) {
+    for (const char *name : statisticNames) out << ',' << name;
+  }
+  out << '\n';
+
+  out << std::fixed << std::setprecision(4);
+  for (const auto &scope : getStats()) {
+    out << scope.name << ',' << scope.samples << ',' << scope.minMs << ','
+        << scope.avgMs << ',' << scope.p99Ms;
+    if (!statisticsPools.empty()) {
+      for (uint64_t value : scope.statistics) out << ',' << value;
+    }
+    out << '\n';
+  }
+}
+
+void VulkanProfiler::writeJson(std::ostream &out) const {
+  out << std::fixed << std::setprecision(4);
+  out << "{\n  \"timestamp_period_ns\": " << timestampPeriodNs
+      << ",\n  \"scopes\": [";
+
+  auto stats = getStats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    const auto &scope = stats[i];
+    out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << scope.name
+        << "\", \"samples\": " << scope.samples
+        << ", \"min_ms\": " << scope.minMs << ", \"avg_ms\": " << scope.avgMs
+        << ", \"p99_ms\": " << scope.p99Ms;
+    if (!statisticsPools.empty()) {
+      out << ", \"pipeline_statistics\": {";
+      for (size_t s = 0; s < STATISTIC_COUNT; s++) {
+        out << (s == 0 ? "" : ", ") << '"' << statisticNames[s]
+            << "\": " << scope.statistics[s];
+      }
+      out << '}';
+    }
+    out << '}';
+  }
+
+  out << "\n  ]\n}\n";
+}
@@ -0,0 +1,82 @@
+#ifndef VULKAN_PROFILER_H
+#define VULKAN_PROFILER_H
+
+class VulkanDevice;
+#include <array>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// GPU-side profiler built on timestamp queries. Each frame in flight owns its
+// own query pool, and a pool is read back only after the frame's timeline
+// value has been waited on, so collecting results never stalls the CPU.
+class VulkanProfiler {
+public:
+  static constexpr uint32_t MAX_SCOPES = 32;
+  static constexpr size_t HISTORY_SIZE = 256;
+
+  // Counters gathered when pipeline statistics are enabled, in the bit order
+  // Vulkan writes them back.
+  static constexpr size_t STATISTIC_COUNT = 5;
+  static const std::array<const char *, STATISTIC_COUNT> statisticNames;
+
+  struct ScopeStats {
+    std::string name;
+    size_t samples;
+    double minMs;
+    double avgMs;
+    double p99Ms;
+    std::array<uint64_t, STATISTIC_COUNT> statistics;
+  };
+
+  VulkanProfiler(VulkanDevice &device);
+
+  VulkanProfiler(const VulkanProfiler &) = delete;
+  VulkanProfiler &operator=(const VulkanProfiler &) = delete;
+
+  void create(uint32_t framesInFlight, bool pipelineStatistics);
+  void cleanup();
+
+  bool isEnabled() const { return !timestampPools.empty(); }
+  // Statistics a secondary command buffer must declare as inherited when it
+  // executes inside a scope; zero when none are collected.
+  VkQueryPipelineStatisticFlags getInheritedStatistics() const;
+
+  // Must be called outside a render pass, once per frame before any scope.
+  // Harvests the results left in this frame's pools by its previous use.
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame);
+  uint32_t beginScope(VkCommandBuffer commandBuffer, const char *name);
+  void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+  std::vector<ScopeStats> getStats() const;
+  // Drops the sample history, e.g. to discard warmup frames.
+  void resetStats();
+  void writeCsv(std::ostream &out) const;
+  void writeJson(std::ostream &out) const;
+
+private:
+  struct ScopeHistory {
+    std::string name;
+    std::vector<double> samplesMs;
+    size_t next = 0;
+    std::array<uint64_t, STATISTIC_COUNT> statistics{};
+  };
+
+  VulkanDevice &device;
+
+  std::vector<VkQueryPool> timestampPools;
+  std::vector<VkQueryPool> statisticsPools;
+  // Scope ids recorded into each frame's pools, in query order.
+  std::vector<std::vector<uint32_t>> frameScopes;
+  std::vector<ScopeHistory> scopes;
+
+  uint32_t currentFrame = 0;
+  double timestampPeriodNs = 1.0;
+  uint64_t timestampMask = ~0ull;
+
+  void collect(uint32_t frame);
+  uint32_t findScope(const char *name);
+};
+
+#endif
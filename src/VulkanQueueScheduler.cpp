@@ -0,0 +1,242 @@
+#include "VulkanQueueScheduler.h"
+#include "VulkanDevice.h"
+#include <stdexcept>
+
+VulkanQueueScheduler::VulkanQueueScheduler(VulkanDevice &device)
+    : device(device) {}
+
+void VulkanQueueScheduler::create(uint32_t framesInFlight) {
+  VulkanDevice::QueueFamilyIndices indices =
+      device.findQueueFamilies(device.getPhysicalDevice());
+
+  lanes[GRAPHICS].family = indices.graphicsFamily.value();
+  lanes[GRAPHICS].queue = device.getGraphicsQueue();
+  lanes[COMPUTE].family = indices.computeFamily.value();
+  lanes[COMPUTE].queue = device.getComputeQueue();
+  lanes[TRANSFER].family = indices.transferFamily.value();
+  lanes[TRANSFER].queue = device.getTransferQueue();
+
+  VkSemaphoreTypeCreateInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &timelineInfo;
+
+  for (Lane &lane : lanes) {
+    if (vkCreateSemaphore(device.getDevice(), &semaphoreInfo,
+                          device.getAllocationCallbacks(),
+                          &lane.timeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create timeline semaphore!");
+    }
+    lane.submittedValue = 0;
+  }
+
+  for (QueueType type : {COMPUTE, TRANSFER}) {
+    Lane &lane = lanes[type];
+    lane.async = device.getConfig().asyncQueues &&
+                 lane.family != lanes[GRAPHICS].family;
+    if (!lane.async) continue;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = lane.family;
+
+    if (vkCreateCommandPool(device.getDevice(), &poolInfo,
+                            device.getAllocationCallbacks(),
+                            &lane.commandPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create queue scheduler command pool!");
+    }
+
+    lane.commandBuffers.resize(framesInFlight);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = lane.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = framesInFlight;
+
+    if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo,
+                                 lane.commandBuffers.data()) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate queue scheduler command buffers!");
+    }
+  }
+}
+
+void VulkanQueueScheduler::cleanup() {
+  for (Lane &lane : lanes) {
+    for (auto &entry : lane.deferred) {
+      entry.second();
+    }
+    lane.deferred.clear();
+
+    vkDestroySemaphore(device.getDevice(), lane.timeline,
+                       device.getAllocationCallbacks());
+    lane.timeline = VK_NULL_HANDLE;
+
+    if (lane.commandPool != VK_NULL_HANDLE) {
+      vkDestroyCommandPool(device.getDevice(), lane.commandPool,
+                           device.getAllocationCallbacks());
+      lane.commandPool = VK_NULL_HANDLE;
+    }
+    lane.commandBuffers.clear();
+  }
+  pendingSemaphores.clear();
+  pendingValues.clear();
+  pendingStages.clear();
+}
+
+uint64_t VulkanQueueScheduler::getCompletedValue(QueueType type) const {
+  uint64_t value = 0;
+  if (vkGetSemaphoreCounterValue(device.getDevice(), lanes[type].timeline,
+                                 &value) != VK_SUCCESS) {
+    throw std::runtime_error("failed to read timeline semaphore!");
+  }
+  return value;
+}
+
+void VulkanQueueScheduler::wait(QueueType type, uint64_t value) const {
+  if (value == 0) return;
+
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &lanes[type].timeline;
+  waitInfo.pValues = &value;
+
+  if (vkWaitSemaphores(device.getDevice(), &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    throw std::runtime_error("failed to wait for timeline semaphore!");
+  }
+}
+
+void VulkanQueueScheduler::deferDestroy(QueueType type,
+                                        std::function<void()> destroy) {
+  Lane &lane = lanes[type];
+  lane.deferred.emplace_back(lane.submittedValue, std::move(destroy));
+}
+
+void VulkanQueueScheduler::collectGarbage() {
+  for (uint32_t type = 0; type < QUEUE_TYPE_COUNT; type++) {
+    Lane &lane = lanes[type];
+    if (lane.deferred.empty()) continue;
+
+    uint64_t completed = getCompletedValue(static_cast<QueueType>(type));
+    auto due = lane.deferred.begin();
+    while (due != lane.deferred.end() && due->first <= completed) {
+      due->second();
+      ++due;
+    }
+    lane.deferred.erase(lane.deferred.begin(), due);
+  }
+}
+
+VkCommandBuffer VulkanQueueScheduler::begin(QueueType type, uint32_t frame) {
+  if (!lanes[type].async) {
+    throw std::runtime_error("queue has no command buffers of its own!");
+  }
+
+  VkCommandBuffer commandBuffer = lanes[type].commandBuffers[frame];
+  vkResetCommandBuffer(commandBuffer, 0);
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin recording command buffer!");
+  }
+  return commandBuffer;
+}
+
+void VulkanQueueScheduler::submit(QueueType type, uint32_t frame,
+                                  VkPipelineStageFlags waitStage) {
+  Lane &lane = lanes[type];
+  VkCommandBuffer commandBuffer = lane.commandBuffers[frame];
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+
+  uint64_t signalValue = nextValue(type);
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &lane.timeline;
+
+  if (vkQueueSubmit(lane.queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit command buffer!");
+  }
+
+  pendingSemaphores.push_back(lane.timeline);
+  pendingValues.push_back(signalValue);
+  pendingStages.push_back(waitStage);
+}
+
+void VulkanQueueScheduler::takeGraphicsWaits(
+    std::vector<VkSemaphore> &semaphores, std::vector<uint64_t> &values,
+    std::vector<VkPipelineStageFlags> &stages) {
+  semaphores.insert(semaphores.end(), pendingSemaphores.begin(),
+                    pendingSemaphores.end());
+  values.insert(values.end(), pendingValues.begin(), pendingValues.end());
+  stages.insert(stages.end(), pendingStages.begin(), pendingStages.end());
+  pendingSemaphores.clear();
+  pendingValues.clear();
+  pendingStages.clear();
+}
+
+void VulkanQueueScheduler::releaseBuffer(VkCommandBuffer commandBuffer,
+                                         QueueType from, QueueType to,
+                                         VkBuffer buffer, VkDeviceSize offset,
+                                         VkDeviceSize size,
+                                         VkPipelineStageFlags srcStage,
+                                         VkAccessFlags srcAccess) const {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = srcAccess;
+  // Visibility is the acquiring queue's business.
+  barrier.dstAccessMask = 0;
+  barrier.srcQueueFamilyIndex = lanes[from].family;
+  barrier.dstQueueFamilyIndex = lanes[to].family;
+  barrier.buffer = buffer;
+  barrier.offset = offset;
+  barrier.size = size;
+
+  vkCmdPipelineBarrier(commandBuffer, srcStage,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
+
+void VulkanQueueScheduler::acquireBuffer(VkCommandBuffer commandBuffer,
+                                         QueueType from, QueueType to,
+                                         VkBuffer buffer, VkDeviceSize offset,
+                                         VkDeviceSize size,
+                                         VkPipelineStageFlags dstStage,
+                                         VkAccessFlags dstAccess) const {
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  // The semaphore wait already made the writes available.
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = dstAccess;
+  barrier.srcQueueFamilyIndex = lanes[from].family;
+  barrier.dstQueueFamilyIndex = lanes[to].family;
+  barrier.buffer = buffer;
+  barrier.offset = offset;
+  barrier.size = size;
+
+  // Starting from dstStage chains the barrier onto a semaphore wait at the
+  // same stage.
+  vkCmdPipelineBarrier(commandBuffer, dstStage, dstStage, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
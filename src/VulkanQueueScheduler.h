@@ -0,0 +1,113 @@
+#ifndef VULKAN_QUEUE_SCHEDULER_H
+#define VULKAN_QUEUE_SCHEDULER_H
+
+class VulkanDevice;
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Submits compute and transfer work on queues of their own, so it overlaps
+// the graphics queue instead of queuing behind it, and tracks completion on
+// every queue with a timeline semaphore.
+//
+// Each queue type owns a timeline whose value only ever grows: a submission
+// signals nextValue(), so "has this work finished" is a single comparison
+// and the CPU waits for exactly the value it needs, with no fences to reset.
+// The renderer paces frames on the graphics timeline, the staging ring
+// reuses segments on the transfer timeline, and deferDestroy() releases
+// objects once their queue has moved past their last use, which is how the
+// renderer retires framebuffers and render graph images on a resize without
+// waiting for the device to go idle. Presentation does not signal these
+// timelines, so what presents use is retired by the renderer instead.
+//
+// A compute or transfer queue is only asynchronous when the device has a
+// dedicated family for it and DeviceConfig::asyncQueues allows it; callers
+// otherwise record into the graphics command buffer as before. Async work
+// gets a command buffer per frame in flight: begin() hands it out, submit()
+// sends it and queues a wait on its timeline value for the frame's graphics
+// submission, which collects it with takeGraphicsWaits(). Resources written
+// on one family and read on another move between them with releaseBuffer()
+// on the producing queue and acquireBuffer() on the consuming one.
+class VulkanQueueScheduler {
+public:
+  enum QueueType { GRAPHICS, COMPUTE, TRANSFER, QUEUE_TYPE_COUNT };
+
+  VulkanQueueScheduler(VulkanDevice &device);
+
+  VulkanQueueScheduler(const VulkanQueueScheduler &) = delete;
+  VulkanQueueScheduler &operator=(const VulkanQueueScheduler &) = delete;
+
+  void create(uint32_t framesInFlight);
+  // Runs every pending deferred destruction; the device must be idle.
+  void cleanup();
+
+  bool isAsync(QueueType type) const { return lanes[type].async; }
+  uint32_t getFamily(QueueType type) const { return lanes[type].family; }
+  VkQueue getQueue(QueueType type) const { return lanes[type].queue; }
+
+  VkSemaphore getTimeline(QueueType type) const { return lanes[type].timeline; }
+  // Reserves the value the caller's next submission to the queue signals on
+  // its timeline. Submissions must signal them in the order reserved.
+  uint64_t nextValue(QueueType type) { return ++lanes[type].submittedValue; }
+  uint64_t getSubmittedValue(QueueType type) const {
+    return lanes[type].submittedValue;
+  }
+  uint64_t getCompletedValue(QueueType type) const;
+  // Blocks until the queue's timeline reaches value; 0 never blocks.
+  void wait(QueueType type, uint64_t value) const;
+
+  // Runs destroy once everything submitted to the queue so far completes.
+  void deferDestroy(QueueType type, std::function<void()> destroy);
+  // Runs the deferred destructions that are due; call once per frame.
+  void collectGarbage();
+
+  // The graphics submission of the frame must have completed: it waited on
+  // the previous use of this command buffer.
+  VkCommandBuffer begin(QueueType type, uint32_t frame);
+  // Ends and submits what begin() returned. Graphics waits on it at
+  // waitStage in the same frame.
+  void submit(QueueType type, uint32_t frame, VkPipelineStageFlags waitStage);
+  // Appends the timeline waits queued since the last call for the graphics
+  // submission, one semaphore, value and stage each.
+  void takeGraphicsWaits(std::vector<VkSemaphore> &semaphores,
+                         std::vector<uint64_t> &values,
+                         std::vector<VkPipelineStageFlags> &stages);
+
+  // Queue family ownership transfer of a buffer range. The release is
+  // recorded on the source queue after its last write, the acquire on the
+  // destination queue before its first read, with a semaphore between them.
+  void releaseBuffer(VkCommandBuffer commandBuffer, QueueType from,
+                     QueueType to, VkBuffer buffer, VkDeviceSize offset,
+                     VkDeviceSize size, VkPipelineStageFlags srcStage,
+                     VkAccessFlags srcAccess) const;
+  void acquireBuffer(VkCommandBuffer commandBuffer, QueueType from,
+                     QueueType to, VkBuffer buffer, VkDeviceSize offset,
+                     VkDeviceSize size, VkPipelineStageFlags dstStage,
+                     VkAccessFlags dstAccess) const;
+
+private:
+  struct Lane {
+    uint32_t family = 0;
+    VkQueue queue = VK_NULL_HANDLE;
+    bool async = false;
+    VkSemaphore timeline = VK_NULL_HANDLE;
+    uint64_t submittedValue = 0;
+    // Only for async lanes; indexed by frame in flight.
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    // Destructions waiting for the timeline to reach their value, in value
+    // order.
+    std::vector<std::pair<uint64_t, std::function<void()>>> deferred;
+  };
+
+  VulkanDevice &device;
+  Lane lanes[QUEUE_TYPE_COUNT];
+
+  std::vector<VkSemaphore> pendingSemaphores;
+  std::vector<uint64_t> pendingValues;
+  std::vector<VkPipelineStageFlags> pendingStages;
+};
+
+#endif
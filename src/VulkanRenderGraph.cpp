@@ -0,0 +1,691 @@
+#include "VulkanRenderGraph.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Usage flags a TRANSIENT_ATTACHMENT image may be combined with.
+constexpr VkImageUsageFlags ATTACHMENT_USAGE =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+    VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+bool overlaps(VkDeviceSize offsetA, VkDeviceSize sizeA, VkDeviceSize offsetB,
+              VkDeviceSize sizeB) {
+  return offsetA < offsetB + sizeB && offsetB < offsetA + sizeA;
+}
+
+} // namespace
+
+VulkanRenderGraph::VulkanRenderGraph(VulkanDevice &device) : device(device) {}
+
+VulkanRenderGraph::Resource
+VulkanRenderGraph::addResource(ResourceInfo &&resource) {
+  resources.push_back(std::move(resource));
+  return static_cast<Resource>(resources.size() - 1);
+}
+
+VulkanRenderGraph::Resource
+VulkanRenderGraph::importImage(const std::string &name,
+                               VkImageAspectFlags aspect, const Usage &initial,
+                               const Usage &final) {
+  ResourceInfo resource;
+  resource.name = name;
+  resource.imported = true;
+  resource.image = true;
+  resource.aspect = aspect;
+  resource.initial = initial;
+  resource.final = final;
+  return addResource(std::move(resource));
+}
+
+VulkanRenderGraph::Resource
+VulkanRenderGraph::importBuffer(const std::string &name, const Usage &initial) {
+  ResourceInfo resource;
+  resource.name = name;
+  resource.imported = true;
+  resource.initial = initial;
+  return addResource(std::move(resource));
+}
+
+VulkanRenderGraph::Resource
+VulkanRenderGraph::createImage(const std::string &name, VkFormat format,
+                               VkImageUsageFlags usage,
+                               VkImageAspectFlags aspect) {
+  ResourceInfo resource;
+  resource.name = name;
+  resource.image = true;
+  resource.format = format;
+  resource.usage = usage;
+  resource.aspect = aspect;
+  return addResource(std::move(resource));
+}
+
+VulkanRenderGraph::Pass VulkanRenderGraph::addPass(const std::string &name,
+                                                   RecordFunction record) {
+  PassInfo pass;
+  pass.name = name;
+  pass.record = std::move(record);
+  passes.push_back(std::move(pass));
+  return static_cast<Pass>(passes.size() - 1);
+}
+
+void VulkanRenderGraph::read(Pass pass, Resource resource, const Usage &usage) {
+  passes[pass].accesses.push_back({resource, usage, false});
+}
+
+void VulkanRenderGraph::write(Pass pass, Resource resource, const Usage &usage) {
+  passes[pass].accesses.push_back({resource, usage, true});
+}
+
+void VulkanRenderGraph::addColorAttachment(
+    Pass pass, Resource resource, const std::optional<VkClearValue> &clear) {
+  Attachment attachment;
+  attachment.resource = resource;
+  attachment.clear = clear;
+  passes[pass].colorAttachments.push_back(attachment);
+}
+
+void VulkanRenderGraph::setDepthAttachment(
+    Pass pass, Resource resource, const std::optional<VkClearValue> &clear) {
+  Attachment attachment;
+  attachment.resource = resource;
+  attachment.clear = clear;
+  passes[pass].depthAttachment = attachment;
+}
+
+void VulkanRenderGraph::setSecondaryContents(Pass pass, bool secondaries) {
+  passes[pass].secondaries = secondaries;
+}
+
+void VulkanRenderGraph::compile(VkExtent2D extent) {
+  this->extent = extent;
+
+  cullPasses();
+  resolveAttachments();
+  createTransientImages();
+  computeBarriers();
+}
+
+void VulkanRenderGraph::cullPasses() {
+  // Walking backwards, a pass survives when it writes something imported or
+  // read by a surviving pass after it. Loading an attachment reads it.
+  std::vector<bool> needed(resources.size(), false);
+
+  for (size_t i = passes.size(); i-- > 0;) {
+    PassInfo &pass = passes[i];
+    auto contributes = [&](Resource resource) {
+      return resources[resource].imported || needed[resource];
+    };
+
+    pass.live = false;
+    for (const Access &access : pass.accesses) {
+      pass.live |= access.write && contributes(access.resource);
+    }
+    for (const Attachment &attachment : pass.colorAttachments) {
+      pass.live |= contributes(attachment.resource);
+    }
+    if (pass.depthAttachment) {
+      pass.live |= contributes(pass.depthAttachment->resource);
+    }
+    if (!pass.live) continue;
+
+    for (const Access &access : pass.accesses) {
+      if (!access.write) needed[access.resource] = true;
+    }
+    for (const Attachment &attachment : pass.colorAttachments) {
+      if (!attachment.clear) needed[attachment.resource] = true;
+    }
+    if (pass.depthAttachment && !pass.depthAttachment->clear) {
+      needed[pass.depthAttachment->resource] = true;
+    }
+  }
+}
+
+void VulkanRenderGraph::resolveAttachments() {
+  std::vector<uint32_t> lastUse(resources.size(), 0);
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (!passes[i].live) continue;
+    for (const Access &access : mergedAccesses(passes[i])) {
+      lastUse[access.resource] = i;
+    }
+  }
+
+  // Imported images arrive with contents unless they start out UNDEFINED.
+  std::vector<bool> written(resources.size(), false);
+  for (size_t r = 0; r < resources.size(); r++) {
+    written[r] = resources[r].imported &&
+                 resources[r].initial.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    PassInfo &pass = passes[i];
+    if (!pass.live) continue;
+
+    auto resolve = [&](Attachment &attachment) {
+      Resource resource = attachment.resource;
+      if (attachment.clear) {
+        attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+      } else {
+        attachment.loadOp = written[resource] ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                              : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      }
+      attachment.storeOp =
+          resources[resource].imported || lastUse[resource] > i
+              ? VK_ATTACHMENT_STORE_OP_STORE
+              : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      written[resource] = true;
+    };
+
+    for (Attachment &attachment : pass.colorAttachments) {
+      resolve(attachment);
+    }
+    if (pass.depthAttachment) {
+      resolve(*pass.depthAttachment);
+    }
+    for (const Access &access : pass.accesses) {
+      if (access.write) written[access.resource] = true;
+    }
+  }
+}
+
+std::vector<VulkanRenderGraph::Access>
+VulkanRenderGraph::mergedAccesses(const PassInfo &pass) const {
+  std::vector<Access> accesses;
+
+  for (const Attachment &attachment : pass.colorAttachments) {
+    Usage usage;
+    usage.stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    usage.access = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    if (attachment.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) {
+      usage.access |= VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT;
+    }
+    usage.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    accesses.push_back({attachment.resource, usage, true});
+  }
+  if (pass.depthAttachment) {
+    // Depth testing reads the attachment whatever the load op.
+    Usage usage;
+    usage.stage = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                  VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+    usage.access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                   VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    usage.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    accesses.push_back({pass.depthAttachment->resource, usage, true});
+  }
+
+  // A resource used several ways by one pass gets a single barrier covering
+  // all of them.
+  for (const Access &access : pass.accesses) {
+    auto same = std::find_if(accesses.begin(), accesses.end(),
+                             [&](const Access &other) {
+                               return other.resource == access.resource;
+                             });
+    if (same == accesses.end()) {
+      accesses.push_back(access);
+      continue;
+    }
+    if (resources[access.resource].image &&
+        same->usage.layout != access.usage.layout) {
+      throw std::runtime_error("render graph pass " + pass.name + " uses " +
+                               resources[access.resource].name +
+                               " in two layouts!");
+    }
+    same->usage.stage |= access.usage.stage;
+    same->usage.access |= access.usage.access;
+    same->write |= access.write;
+  }
+
+  return accesses;
+}
+
+void VulkanRenderGraph::createTransientImages() {
+  for (ResourceInfo &resource : resources) {
+    resource.firstPass = UINT32_MAX;
+    resource.lastPass = 0;
+  }
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (!passes[i].live) continue;
+    for (const Access &access : mergedAccesses(passes[i])) {
+      ResourceInfo &resource = resources[access.resource];
+      resource.firstPass = std::min(resource.firstPass, i);
+      resource.lastPass = std::max(resource.lastPass, i);
+    }
+  }
+
+  std::vector<Resource> transients;
+  bool transientOnly = true;
+  uint32_t memoryTypeBits = ~0u;
+  VkDeviceSize alignment = 1;
+
+  for (Resource r = 0; r < resources.size(); r++) {
+    ResourceInfo &resource = resources[r];
+    if (resource.imported || resource.firstPass == UINT32_MAX) continue;
+
+    // Contents never outlive the frame, so images only rendered to never
+    // need to leave tile memory.
+    VkImageUsageFlags usage = resource.usage;
+    if ((usage & ~ATTACHMENT_USAGE) == 0) {
+      usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    } else {
+      transientOnly = false;
+    }
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = resource.format;
+    imageInfo.extent = {extent.width, extent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = usage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(device.getDevice(), &imageInfo,
+                      device.getAllocationCallbacks(),
+                      &resource.handle) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create render graph image " +
+                               resource.name + "!");
+    }
+    vkGetImageMemoryRequirements(device.getDevice(), resource.handle,
+                                 &resource.requirements);
+
+    memoryTypeBits &= resource.requirements.memoryTypeBits;
+    alignment = std::max(alignment, resource.requirements.alignment);
+    transients.push_back(r);
+  }
+
+  unaliasedMemorySize = 0;
+  if (transients.empty()) return;
+  if (memoryTypeBits == 0) {
+    throw std::runtime_error("render graph images share no memory type!");
+  }
+
+  // Largest first, each at the lowest offset that does not collide with an
+  // image alive at the same time.
+  std::sort(transients.begin(), transients.end(), [&](Resource a, Resource b) {
+    return resources[a].requirements.size > resources[b].requirements.size;
+  });
+
+  VkDeviceSize totalSize = 0;
+  for (size_t i = 0; i < transients.size(); i++) {
+    ResourceInfo &resource = resources[transients[i]];
+    VkDeviceSize size = resource.requirements.size;
+    VkDeviceSize offset = 0;
+
+    bool moved = true;
+    while (moved) {
+      moved = false;
+      offset = (offset + resource.requirements.alignment - 1) /
+               resource.requirements.alignment * resource.requirements.alignment;
+      for (size_t j = 0; j < i; j++) {
+        const ResourceInfo &placed = resources[transients[j]];
+        bool concurrent = resource.firstPass <= placed.lastPass &&
+                          placed.firstPass <= resource.lastPass;
+        if (concurrent && overlaps(offset, size, placed.memoryOffset,
+                                   placed.requirements.size)) {
+          offset = placed.memoryOffset + placed.requirements.size;
+          moved = true;
+        }
+      }
+    }
+
+    resource.memoryOffset = offset;
+    totalSize = std::max(totalSize, offset + size);
+    unaliasedMemorySize += size;
+  }
+
+  VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if (transientOnly) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(device.getPhysicalDevice(),
+                                        &memoryProperties);
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      if ((memoryTypeBits & (1u << i)) &&
+          (memoryProperties.memoryTypes[i].propertyFlags &
+           VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+        properties = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        break;
+      }
+    }
+  }
+
+  VkMemoryRequirements requirements{};
+  requirements.size = totalSize;
+  requirements.alignment = alignment;
+  requirements.memoryTypeBits = memoryTypeBits;
+  transientMemory = device.getMemoryAllocator().allocate(
+      requirements, properties, false, true);
+
+  for (Resource r : transients) {
+    ResourceInfo &resource = resources[r];
+    vkBindImageMemory(device.getDevice(), resource.handle,
+                      transientMemory.memory,
+                      transientMemory.offset + resource.memoryOffset);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = resource.handle;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = resource.format;
+    viewInfo.subresourceRange.aspectMask = resource.aspect;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device.getDevice(), &viewInfo,
+                          device.getAllocationCallbacks(),
+                          &resource.view) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create render graph image view " +
+                               resource.name + "!");
+    }
+  }
+}
+
+bool VulkanRenderGraph::addBarrier(Resource resource, State &state,
+                                   const Usage &usage, bool write,
+                                   std::vector<Barrier> &barriers) const {
+  bool image = resources[resource].image;
+  bool transition = image && usage.layout != state.layout;
+
+  if (!write && !transition) {
+    // Reads only need the last write made visible to them, once.
+    if ((usage.stage & ~state.visibleStages) == 0 &&
+        (usage.access & ~state.visibleAccess) == 0) {
+      return false;
+    }
+    state.visibleStages |= usage.stage;
+    state.visibleAccess |= usage.access;
+    if (state.lastWrite.stage == VK_PIPELINE_STAGE_2_NONE) return false;
+
+    Usage src = state.lastWrite;
+    src.layout = state.layout;
+    Usage dst = usage;
+    dst.layout = state.layout;
+    barriers.push_back({resource, src, dst});
+    return true;
+  }
+
+  // Writes and layout transitions also wait for everything that read the
+  // previous contents.
+  Usage src;
+  src.stage = state.lastWrite.stage | state.visibleStages;
+  src.access = state.lastWrite.access;
+  src.layout = state.layout;
+
+  state.lastWrite.stage = usage.stage;
+  state.lastWrite.access = write ? usage.access : VK_ACCESS_2_NONE;
+  state.visibleStages = usage.stage;
+  state.visibleAccess = usage.access;
+  if (image) state.layout = usage.layout;
+
+  if (!transition && src.stage == VK_PIPELINE_STAGE_2_NONE) return false;
+
+  Usage dst = usage;
+  if (!image) dst.layout = src.layout;
+  barriers.push_back({resource, src, dst});
+  return true;
+}
+
+void VulkanRenderGraph::computeBarriers() {
+  std::vector<State> initial(resources.size());
+  for (size_t r = 0; r < resources.size(); r++) {
+    if (!resources[r].imported) continue;
+    const Usage &usage = resources[r].initial;
+    initial[r].lastWrite.stage = usage.stage;
+    initial[r].visibleStages = usage.stage;
+    initial[r].visibleAccess = usage.access;
+    initial[r].layout = usage.layout;
+  }
+
+  // Transient memory is shared by every frame in flight, and the previous
+  // frame on the queue may still be using it when this one starts. The
+  // first use of a memory range therefore waits for how the whole frame
+  // leaves that range, which also covers images aliasing it earlier in
+  // this frame. A transient's first use always discards the contents, so
+  // how a frame leaves it does not depend on what came before.
+  std::vector<State> frameEnd = initial;
+  std::vector<Barrier> unused;
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (!passes[i].live) continue;
+    for (const Access &access : mergedAccesses(passes[i])) {
+      addBarrier(access.resource, frameEnd[access.resource], access.usage,
+                 access.write, unused);
+    }
+  }
+
+  std::vector<State> states = initial;
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    PassInfo &pass = passes[i];
+    pass.barriers.clear();
+    if (!pass.live) continue;
+
+    for (const Access &access : mergedAccesses(pass)) {
+      const ResourceInfo &resource = resources[access.resource];
+      State &state = states[access.resource];
+
+      if (!resource.imported && resource.firstPass == i) {
+        // Whatever had the memory before must be done with it.
+        state = State();
+        for (size_t o = 0; o < resources.size(); o++) {
+          const ResourceInfo &other = resources[o];
+          if (other.imported || other.firstPass == UINT32_MAX) continue;
+          if (overlaps(resource.memoryOffset, resource.requirements.size,
+                       other.memoryOffset, other.requirements.size)) {
+            state.lastWrite.stage |=
+                frameEnd[o].lastWrite.stage | frameEnd[o].visibleStages;
+            state.lastWrite.access |= frameEnd[o].lastWrite.access;
+          }
+        }
+      }
+
+      addBarrier(access.resource, state, access.usage, access.write,
+                 pass.barriers);
+    }
+  }
+
+  finalBarriers.clear();
+  for (Resource r = 0; r < resources.size(); r++) {
+    const ResourceInfo &resource = resources[r];
+    if (!resource.imported || !resource.image) continue;
+    if (resource.final.stage == VK_PIPELINE_STAGE_2_NONE &&
+        resource.final.layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+      continue;
+    }
+    addBarrier(r, states[r], resource.final, false, finalBarriers);
+  }
+}
+
+void VulkanRenderGraph::setImage(Resource resource, VkImage image,
+                                 VkImageView view) {
+  resources[resource].handle = image;
+  resources[resource].view = view;
+}
+
+void VulkanRenderGraph::setBuffer(Resource resource, VkBuffer buffer,
+                                  VkDeviceSize offset, VkDeviceSize size) {
+  resources[resource].buffer = buffer;
+  resources[resource].offset = offset;
+  resources[resource].size = size;
+}
+
+void VulkanRenderGraph::execute(VkCommandBuffer commandBuffer) {
+  VulkanProfiler &profiler = device.getProfiler();
+
+  for (const PassInfo &pass : passes) {
+    if (!pass.live) continue;
+
+    uint32_t scope = profiler.beginScope(commandBuffer, pass.name.c_str());
+    recordBarriers(commandBuffer, pass.barriers);
+
+    bool rendering = !pass.colorAttachments.empty() || pass.depthAttachment;
+    if (rendering) beginRendering(commandBuffer, pass);
+    pass.record(commandBuffer);
+    if (rendering) vkCmdEndRendering(commandBuffer);
+
+    profiler.endScope(commandBuffer, scope);
+  }
+
+  recordBarriers(commandBuffer, finalBarriers);
+}
+
+void VulkanRenderGraph::recordBarriers(VkCommandBuffer commandBuffer,
+                                       const std::vector<Barrier> &barriers) {
+  if (barriers.empty()) return;
+
+  imageBarriers.clear();
+  bufferBarriers.clear();
+
+  for (const Barrier &barrier : barriers) {
+    const ResourceInfo &resource = resources[barrier.resource];
+
+    if (resource.image) {
+      VkImageMemoryBarrier2 imageBarrier{};
+      imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+      imageBarrier.srcStageMask = barrier.src.stage;
+      imageBarrier.srcAccessMask = barrier.src.access;
+      imageBarrier.dstStageMask = barrier.dst.stage;
+      imageBarrier.dstAccessMask = barrier.dst.access;
+      imageBarrier.oldLayout = barrier.src.layout;
+      imageBarrier.newLayout = barrier.dst.layout;
+      imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.image = resource.handle;
+      imageBarrier.subresourceRange.aspectMask = resource.aspect;
+      imageBarrier.subresourceRange.baseMipLevel = 0;
+      imageBarrier.subresourceRange.levelCount = 1;
+      imageBarrier.subresourceRange.baseArrayLayer = 0;
+      imageBarrier.subresourceRange.layerCount = 1;
+      imageBarriers.push_back(imageBarrier);
+    } else {
+      VkBufferMemoryBarrier2 bufferBarrier{};
+      bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+      bufferBarrier.srcStageMask = barrier.src.stage;
+      bufferBarrier.srcAccessMask = barrier.src.access;
+      bufferBarrier.dstStageMask = barrier.dst.stage;
+      bufferBarrier.dstAccessMask = barrier.dst.access;
+      bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      bufferBarrier.buffer = resource.buffer;
+      bufferBarrier.offset = resource.offset;
+      bufferBarrier.size = resource.size;
+      bufferBarriers.push_back(bufferBarrier);
+    }
+  }
+
+  VkDependencyInfo dependencyInfo{};
+  dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dependencyInfo.bufferMemoryBarrierCount =
+      static_cast<uint32_t>(bufferBarriers.size());
+  dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+  dependencyInfo.imageMemoryBarrierCount =
+      static_cast<uint32_t>(imageBarriers.size());
+  dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+  vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void VulkanRenderGraph::beginRendering(VkCommandBuffer commandBuffer,
+                                       const PassInfo &pass) {
+  auto attachmentInfo = [&](const Attachment &attachment, VkImageLayout layout) {
+    VkRenderingAttachmentInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    info.imageView = resources[attachment.resource].view;
+    info.imageLayout = layout;
+    info.loadOp = attachment.loadOp;
+    info.storeOp = attachment.storeOp;
+    if (attachment.clear) info.clearValue = *attachment.clear;
+    return info;
+  };
+
+  colorInfos.clear();
+  for (const Attachment &attachment : pass.colorAttachments) {
+    colorInfos.push_back(
+        attachmentInfo(attachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL));
+  }
+
+  VkRenderingAttachmentInfo depthInfo{};
+  if (pass.depthAttachment) {
+    depthInfo = attachmentInfo(*pass.depthAttachment,
+                               VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  }
+
+  VkRenderingInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+  renderingInfo.flags =
+      pass.secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+  renderingInfo.renderArea.offset = {0, 0};
+  renderingInfo.renderArea.extent = extent;
+  renderingInfo.layerCount = 1;
+  renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorInfos.size());
+  renderingInfo.pColorAttachments = colorInfos.data();
+  renderingInfo.pDepthAttachment = pass.depthAttachment ? &depthInfo : nullptr;
+
+  vkCmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+uint32_t VulkanRenderGraph::getCulledPassCount() const {
+  return static_cast<uint32_t>(
+      std::count_if(passes.begin(), passes.end(),
+                    [](const PassInfo &pass) { return !pass.live; }));
+}
+
+void VulkanRenderGraph::cleanup() {
+  for (ResourceInfo &resource : resources) {
+    if (resource.imported) continue;
+    if (resource.view != VK_NULL_HANDLE) {
+      vkDestroyImageView(device.getDevice(), resource.view,
+                         device.getAllocationCallbacks());
+      resource.view = VK_NULL_HANDLE;
+    }
+    if (resource.handle != VK_NULL_HANDLE) {
+      vkDestroyImage(device.getDevice(), resource.handle,
+                     device.getAllocationCallbacks());
+      resource.handle = VK_NULL_HANDLE;
+    }
+  }
+
+  if (transientMemory.memory != VK_NULL_HANDLE) {
+    device.getMemoryAllocator().free(transientMemory);
+    transientMemory = VulkanAllocation();
+  }
+  unaliasedMemorySize = 0;
+}
+
+void VulkanRenderGraph::retire() {
+  std::vector<std::pair<VkImage, VkImageView>> images;
+  for (ResourceInfo &resource : resources) {
+    if (resource.imported || resource.handle == VK_NULL_HANDLE) continue;
+    images.emplace_back(resource.handle, resource.view);
+    resource.handle = VK_NULL_HANDLE;
+    resource.view = VK_NULL_HANDLE;
+  }
+  VulkanAllocation memory = transientMemory;
+  transientMemory = VulkanAllocation();
+  unaliasedMemorySize = 0;
+  if (images.empty()) return;
+
+  device.getQueueScheduler().deferDestroy(
+      VulkanQueueScheduler::GRAPHICS, [this, images, memory]() mutable {
+        for (const auto &image : images) {
+          if (image.second != VK_NULL_HANDLE) {
+            vkDestroyImageView(device.getDevice(), image.second,
+                               device.getAllocationCallbacks());
+          }
+          vkDestroyImage(device.getDevice(), image.first,
+                         device.getAllocationCallbacks());
+        }
+        device.getMemoryAllocator().free(memory);
+      });
+}
+
+void VulkanRenderGraph::reset() {
+  resources.clear();
+  passes.clear();
+  finalBarriers.clear();
+}
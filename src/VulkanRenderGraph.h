@@ -0,0 +1,211 @@
+#ifndef VULKAN_RENDER_GRAPH_H
+#define VULKAN_RENDER_GRAPH_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Describes a frame as passes that declare the resources they read and write,
+// and works out the synchronization between them instead of having it written
+// by hand.
+//
+// compile() walks the passes in the order they were added, which must be an
+// order in which every resource is written before it is read:
+//  - passes whose writes never reach an imported resource are culled;
+//  - each surviving pass gets the smallest set of synchronization2 barriers
+//    that covers its hazards and layout transitions, batched into a single
+//    vkCmdPipelineBarrier2 before it runs;
+//  - transient images, which only live within the frame, are created and
+//    packed into one allocation, sharing memory whenever their lifetimes do
+//    not overlap. Images only ever used as attachments are made
+//    TRANSIENT_ATTACHMENT and put in LAZILY_ALLOCATED memory when the device
+//    has it, so tiled GPUs may never back them with memory at all;
+//  - attachment load and store ops are chosen from the other uses of the
+//    attachment: contents nobody reads afterwards are not stored, contents
+//    nobody wrote before are not loaded.
+//
+// Passes with attachments are wrapped in vkCmdBeginRendering, so the graph
+// needs dynamic rendering and synchronization2. Imported resources, like the
+// swap chain image, are owned elsewhere and bound with setImage() and
+// setBuffer() before every execute(); the graph only tracks the state they
+// arrive in and must be left in.
+class VulkanRenderGraph {
+public:
+  using Resource = uint32_t;
+  using Pass = uint32_t;
+  using RecordFunction = std::function<void(VkCommandBuffer)>;
+
+  // How a resource is used at one point of the frame. layout is ignored for
+  // buffers.
+  struct Usage {
+    VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  // One resource's part of the barrier batch recorded before a pass.
+  struct Barrier {
+    Resource resource;
+    Usage src;
+    Usage dst;
+  };
+
+  VulkanRenderGraph(VulkanDevice &device);
+
+  VulkanRenderGraph(const VulkanRenderGraph &) = delete;
+  VulkanRenderGraph &operator=(const VulkanRenderGraph &) = delete;
+
+  // initial is what the work before the graph already made visible, final
+  // what the work after it expects; a final usage of NONE leaves the image
+  // as the last pass left it.
+  Resource importImage(const std::string &name, VkImageAspectFlags aspect,
+                       const Usage &initial, const Usage &final);
+  Resource importBuffer(const std::string &name, const Usage &initial);
+  // Created by compile() at the graph's extent; contents do not survive the
+  // frame.
+  Resource createImage(const std::string &name, VkFormat format,
+                       VkImageUsageFlags usage, VkImageAspectFlags aspect);
+
+  Pass addPass(const std::string &name, RecordFunction record);
+  void read(Pass pass, Resource resource, const Usage &usage);
+  void write(Pass pass, Resource resource, const Usage &usage);
+  // Renders to the image from pass. Without a clear value the previous
+  // contents are loaded, if there are any.
+  void addColorAttachment(Pass pass, Resource resource,
+                          const std::optional<VkClearValue> &clear = std::nullopt);
+  void setDepthAttachment(Pass pass, Resource resource,
+                          const std::optional<VkClearValue> &clear = std::nullopt);
+  // The pass records its draws into secondary command buffers.
+  void setSecondaryContents(Pass pass, bool secondaries);
+
+  // Culls, allocates transient images and precomputes barriers. Declaring
+  // anything afterwards needs another compile().
+  void compile(VkExtent2D extent);
+  // Binds the frame's handle of an imported resource.
+  void setImage(Resource resource, VkImage image, VkImageView view);
+  void setBuffer(Resource resource, VkBuffer buffer, VkDeviceSize offset,
+                 VkDeviceSize size);
+  // Records the surviving passes, each in a profiler scope of its name.
+  void execute(VkCommandBuffer commandBuffer);
+
+  VkImageView getImageView(Resource resource) const {
+    return resources[resource].view;
+  }
+  uint32_t getCulledPassCount() const;
+  bool isPassCulled(Pass pass) const { return !passes[pass].live; }
+  const std::vector<Barrier> &getBarriers(Pass pass) const {
+    return passes[pass].barriers;
+  }
+  // Where compile() placed a transient image in the transient memory.
+  VkDeviceSize getMemoryOffset(Resource resource) const {
+    return resources[resource].memoryOffset;
+  }
+  // Memory backing the transient images, and what it would take without
+  // aliasing.
+  VkDeviceSize getTransientMemorySize() const { return transientMemory.size; }
+  VkDeviceSize getUnaliasedMemorySize() const { return unaliasedMemorySize; }
+
+  // Destroys the transient images; the declarations stay for the next
+  // compile().
+  void cleanup();
+  // cleanup() for a graph frames in flight may still be executing: the
+  // images and their memory are destroyed once the graphics queue has
+  // finished everything submitted so far.
+  void retire();
+  // Forgets every pass and resource; cleanup() must have run.
+  void reset();
+
+private:
+  struct ResourceInfo {
+    std::string name;
+    bool imported = false;
+    bool image = false;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkImageUsageFlags usage = 0;
+    VkImageAspectFlags aspect = 0;
+    Usage initial;
+    Usage final;
+
+    // Bound per frame when imported, created by compile() when transient.
+    VkImage handle = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = VK_WHOLE_SIZE;
+
+    // Transient images only: memory range and the live passes using it.
+    VkMemoryRequirements requirements{};
+    VkDeviceSize memoryOffset = 0;
+    uint32_t firstPass = UINT32_MAX;
+    uint32_t lastPass = 0;
+  };
+
+  struct Access {
+    Resource resource;
+    Usage usage;
+    bool write;
+  };
+
+  struct Attachment {
+    Resource resource;
+    std::optional<VkClearValue> clear;
+    VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  };
+
+  struct PassInfo {
+    std::string name;
+    RecordFunction record;
+    std::vector<Access> accesses;
+    std::vector<Attachment> colorAttachments;
+    std::optional<Attachment> depthAttachment;
+    bool secondaries = false;
+
+    // Filled in by compile().
+    bool live = false;
+    std::vector<Barrier> barriers;
+  };
+
+  // What has happened to a resource so far while compiling.
+  struct State {
+    Usage lastWrite;
+    // Stages and accesses that have seen the last write, which later writes
+    // must also wait for.
+    VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 visibleAccess = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  VulkanDevice &device;
+
+  std::vector<ResourceInfo> resources;
+  std::vector<PassInfo> passes;
+  std::vector<Barrier> finalBarriers;
+  VkExtent2D extent{};
+
+  VulkanAllocation transientMemory;
+  VkDeviceSize unaliasedMemorySize = 0;
+
+  // Reused by execute() so recording does not allocate.
+  std::vector<VkImageMemoryBarrier2> imageBarriers;
+  std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+  std::vector<VkRenderingAttachmentInfo> colorInfos;
+
+  Resource addResource(ResourceInfo &&resource);
+  void cullPasses();
+  void resolveAttachments();
+  void createTransientImages();
+  void computeBarriers();
+  std::vector<Access> mergedAccesses(const PassInfo &pass) const;
+  bool addBarrier(Resource resource, State &state, const Usage &usage,
+                  bool write, std::vector<Barrier> &barriers) const;
+  void recordBarriers(VkCommandBuffer commandBuffer,
+                      const std::vector<Barrier> &barriers);
+  void beginRendering(VkCommandBuffer commandBuffer, const PassInfo &pass);
+};
+
+#endif
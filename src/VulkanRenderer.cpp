@@ -1,11 +1,28 @@
 #include "VulkanRenderer.h"
 #include "VulkanDevice.h"
+#include "Window.h"
+#include <algorithm>
+#include <iostream>
 #include <stdexcept>
 
-VulkanRenderer::VulkanRenderer(VulkanDevice &device) : device(device) {}
+VulkanRenderer::VulkanRenderer(VulkanDevice &device, uint32_t framesInFlight)
+    : device(device), framesInFlight(framesInFlight), renderGraph(device) {
+  if (framesInFlight == 0) {
+    throw std::runtime_error("frames in flight must be at least 1!");
+  }
+}
 
 void VulkanRenderer::createFramebuffers() {
+  swapChainImages = device.getSwapChain().getSwapChainImages();
   swapChainImageViews = device.getSwapChain().getSwapChainImageViews();
+
+  // Dynamic rendering attaches the image views directly, and the graph's
+  // transient images follow the swap chain extent.
+  if (device.usesDynamicRendering()) {
+    buildRenderGraph();
+    return;
+  }
+
   swapChainFramebuffers.resize(swapChainImageViews.size());
 
   for (size_t i = 0; i < swapChainImageViews.size(); i++) {
@@ -20,7 +37,8 @@ void VulkanRenderer::createFramebuffers() {
     framebufferInfo.height = device.getSwapChain().getSwapChainExtent().height;
     framebufferInfo.layers = 1;
 
-    if (vkCreateFramebuffer(device.getDevice(), &framebufferInfo, nullptr,
+    if (vkCreateFramebuffer(device.getDevice(), &framebufferInfo,
+                            device.getAllocationCallbacks(),
                             &swapChainFramebuffers[i]) != VK_SUCCESS) {
       throw std::runtime_error("failed to create framebuffer!");
     }
@@ -35,21 +53,116 @@ void VulkanRenderer::createCommandPool() {
   poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
 
-  if (vkCreateCommandPool(device.getDevice(), &poolInfo, nullptr,
+  if (vkCreateCommandPool(device.getDevice(), &poolInfo,
+                          device.getAllocationCallbacks(),
                           &commandPool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create command pool!");
   }
 }
 
-void VulkanRenderer::createCommandBuffer() {
+void VulkanRenderer::createWorkerCommandPools(uint32_t threadCount) {
+  recordPool = std::make_unique<ThreadPool>(threadCount);
+  workerCommands.resize(framesInFlight * threadCount);
+
+  // Workers reset pools and record every frame, so what the driver
+  // allocates for them is render loop work.
+  VulkanHostAllocator &hostAllocator = device.getHostAllocator();
+  recordPool->run([&](uint32_t) { hostAllocator.addRenderThread(); });
+
+  VulkanDevice::QueueFamilyIndices queueFamilyIndices =
+      device.findQueueFamilies(device.getPhysicalDevice());
+
+  // One pool per worker and frame: pools are externally synchronized, and a
+  // frame's pool can only be reset once that frame's submission completed.
+  for (auto &commands : workerCommands) {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+    if (vkCreateCommandPool(device.getDevice(), &poolInfo,
+                            device.getAllocationCallbacks(),
+                            &commands.commandPool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create worker command pool!");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commands.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo,
+                                 &commands.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate secondary command buffer!");
+    }
+  }
+}
+
+void VulkanRenderer::createCachedCommandBuffers() {
+  // One buffer per frame in flight and swap chain image: the image fixes the
+  // framebuffer, the frame fixes which ring region the frame data lives in.
+  cachedCommands.resize(framesInFlight * swapChainImageViews.size());
+  std::vector<VkCommandBuffer> buffers(cachedCommands.size());
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+  allocInfo.commandBufferCount = static_cast<uint32_t>(buffers.size());
+
+  if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo,
+                               buffers.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate cached command buffers!");
+  }
+
+  for (size_t i = 0; i < buffers.size(); i++) {
+    cachedCommands[i] = CachedCommands();
+    cachedCommands[i].commandBuffer = buffers[i];
+  }
+}
+
+void VulkanRenderer::destroyCachedCommandBuffers() {
+  std::vector<VkCommandBuffer> buffers;
+  for (auto &cached : cachedCommands) {
+    buffers.push_back(cached.commandBuffer);
+  }
+  if (!buffers.empty()) {
+    vkFreeCommandBuffers(device.getDevice(), commandPool,
+                         static_cast<uint32_t>(buffers.size()), buffers.data());
+  }
+  cachedCommands.clear();
+}
+
+void VulkanRenderer::retireCachedCommandBuffers() {
+  std::vector<VkCommandBuffer> buffers;
+  for (auto &cached : cachedCommands) {
+    buffers.push_back(cached.commandBuffer);
+  }
+  cachedCommands.clear();
+  if (buffers.empty()) return;
+
+  // Freed on the render thread by collectGarbage(), like all other use of
+  // the pool.
+  device.getQueueScheduler().deferDestroy(
+      VulkanQueueScheduler::GRAPHICS, [this, buffers]() {
+        vkFreeCommandBuffers(device.getDevice(), commandPool,
+                             static_cast<uint32_t>(buffers.size()),
+                             buffers.data());
+      });
+}
+
+void VulkanRenderer::createCommandBuffers() {
+  commandBuffers.resize(framesInFlight);
+
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
   allocInfo.commandPool = commandPool;
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = 1;
+  allocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
 
   if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo,
-                               &commandBuffer) != VK_SUCCESS) {
+                               commandBuffers.data()) != VK_SUCCESS) {
     throw std::runtime_error("failed to allocate command buffers!");
   }
 }
@@ -65,6 +178,43 @@ void VulkanRenderer::recordCommandBuffer(VkCommandBuffer commandBuffer,
     throw std::runtime_error("failed to begin recording command buffer!");
   }
 
+  VulkanProfiler &profiler = device.getProfiler();
+  profiler.beginFrame(commandBuffer, currentFrame);
+
+  // The ring is not thread-safe, so per-frame data is written up front and
+  // only its offset is handed to the recording threads.
+  VulkanPipeLine::FrameData frameData = {{1.0f, 1.0f, 1.0f, 1.0f}};
+  uint32_t frameDataOffset = device.getUniformRing().push(frameData);
+
+  if (device.usesDynamicRendering()) {
+    recordRenderGraph(commandBuffer, imageIndex, frameDataOffset);
+  } else {
+    recordRenderPass(commandBuffer, imageIndex, frameDataOffset);
+  }
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+}
+
+void VulkanRenderer::recordRenderPass(VkCommandBuffer commandBuffer,
+                                      uint32_t imageIndex,
+                                      uint32_t frameDataOffset) {
+  VulkanProfiler &profiler = device.getProfiler();
+
+  VulkanCullingPass &cullingPass = device.getCullingPass();
+  if (cullingPass.isEnabled() && cullingPass.isAsync()) {
+    // The profiler's queries live on the graphics queue; only the hand-over
+    // is recorded here.
+    cullingPass.record(commandBuffer, currentFrame);
+  } else if (cullingPass.isEnabled()) {
+    uint32_t cullingScope = profiler.beginScope(commandBuffer, "culling");
+    cullingPass.record(commandBuffer, currentFrame);
+    profiler.endScope(commandBuffer, cullingScope);
+  }
+
+  uint32_t renderPassScope = profiler.beginScope(commandBuffer, "render_pass");
+
   VkRenderPassBeginInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
   renderPassInfo.renderPass = device.getPipeLine().getRenderPass();
@@ -77,10 +227,257 @@ void VulkanRenderer::recordCommandBuffer(VkCommandBuffer commandBuffer,
   renderPassInfo.pClearValues = &clearColor;
 
   vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
-                       VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                    device.getPipeLine().getGraphicsPipeline());
+                       usesSecondaries()
+                           ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                           : VK_SUBPASS_CONTENTS_INLINE);
+  recordPassContents(commandBuffer, imageIndex, frameDataOffset);
+  vkCmdEndRenderPass(commandBuffer);
+
+  profiler.endScope(commandBuffer, renderPassScope);
+
+  VulkanFrameCapture &capture = device.getFrameCapture();
+  if (capture.isEnabled()) {
+    uint32_t captureScope = profiler.beginScope(commandBuffer, "capture");
+    capture.recordAfterRenderPass(commandBuffer, swapChainImages[imageIndex],
+                                  device.isHeadless()
+                                      ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    profiler.endScope(commandBuffer, captureScope);
+  }
+}
+
+void VulkanRenderer::buildRenderGraph() {
+  using Usage = VulkanRenderGraph::Usage;
+  VulkanCullingPass &cullingPass = device.getCullingPass();
+
+  renderGraph.reset();
+
+  // Acquired with the image available semaphore waited on at
+  // COLOR_ATTACHMENT_OUTPUT, and cleared, so the old contents can go.
+  Usage acquired{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                 VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED};
+  // Presentation waits on the render finished semaphore; offscreen images
+  // are left ready to be copied out.
+  Usage released = device.isHeadless()
+                       ? Usage{VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                               VK_ACCESS_2_TRANSFER_READ_BIT,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL}
+                       : Usage{VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                               VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+  swapChainTarget = renderGraph.importImage(
+      "swap_chain", VK_IMAGE_ASPECT_COLOR_BIT, acquired, released);
+
+  VulkanRenderGraph::Resource drawCommands = 0;
+  if (cullingPass.isEnabled()) {
+    // An async cull has been acquired for indirect reads before the graph
+    // runs; otherwise the region was last read a frame in flight ago.
+    Usage handedOver;
+    if (cullingPass.isAsync()) {
+      handedOver.stage = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+      handedOver.access = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+    }
+    drawCommands = renderGraph.importBuffer("draw_commands", handedOver);
+    drawCommandsTarget = drawCommands;
+  }
+
+  if (cullingPass.isEnabled() && !cullingPass.isAsync()) {
+    VulkanRenderGraph::Pass culling =
+        renderGraph.addPass("culling", [this](VkCommandBuffer commandBuffer) {
+          device.getCullingPass().recordCulling(commandBuffer, currentFrame);
+        });
+    renderGraph.write(culling, drawCommands,
+                      {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_2_SHADER_WRITE_BIT});
+  }
+
+  VulkanRenderGraph::Pass main =
+      renderGraph.addPass("render_pass", [this](VkCommandBuffer commandBuffer) {
+        recordPassContents(commandBuffer, graphImageIndex,
+                           graphFrameDataOffset);
+      });
+  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+  renderGraph.addColorAttachment(main, swapChainTarget, clearColor);
+  if (cullingPass.isEnabled()) {
+    renderGraph.read(main, drawCommands,
+                     {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                      VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT});
+  }
+  renderGraph.setSecondaryContents(main, usesSecondaries());
+
+  if (device.getFrameCapture().isEnabled()) {
+    // Only the host reads the readback buffers, after waiting for the
+    // frame's timeline value; importing them keeps the pass from being
+    // culled.
+    VulkanRenderGraph::Resource readback =
+        renderGraph.importBuffer("capture", Usage{});
+    VulkanRenderGraph::Pass capture =
+        renderGraph.addPass("capture", [this](VkCommandBuffer commandBuffer) {
+          device.getFrameCapture().recordCopy(commandBuffer,
+                                              swapChainImages[graphImageIndex]);
+        });
+    renderGraph.read(capture, swapChainTarget,
+                     {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                      VK_ACCESS_2_TRANSFER_READ_BIT,
+                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL});
+    renderGraph.write(capture, readback,
+                      {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                       VK_ACCESS_2_TRANSFER_WRITE_BIT});
+  }
+
+  renderGraph.compile(device.getSwapChain().getSwapChainExtent());
+
+  if (device.getConfig().verbose) {
+    std::cout << "Render graph: " << renderGraph.getCulledPassCount()
+              << " passes culled, "
+              << renderGraph.getTransientMemorySize()
+              << " bytes of transient memory ("
+              << renderGraph.getUnaliasedMemorySize()
+              << " without aliasing)" << std::endl;
+  }
+}
 
+void VulkanRenderer::recordRenderGraph(VkCommandBuffer commandBuffer,
+                                       uint32_t imageIndex,
+                                       uint32_t frameDataOffset) {
+  VulkanCullingPass &cullingPass = device.getCullingPass();
+  if (cullingPass.isEnabled()) {
+    if (cullingPass.isAsync()) {
+      cullingPass.record(commandBuffer, currentFrame);
+    }
+    renderGraph.setBuffer(drawCommandsTarget, cullingPass.getBuffer(),
+                          cullingPass.getFrameOffset(currentFrame),
+                          cullingPass.getFrameSize());
+  }
+  renderGraph.setImage(swapChainTarget, swapChainImages[imageIndex],
+                       swapChainImageViews[imageIndex]);
+
+  graphImageIndex = imageIndex;
+  graphFrameDataOffset = frameDataOffset;
+  renderGraph.execute(commandBuffer);
+}
+
+void VulkanRenderer::recordPassContents(VkCommandBuffer commandBuffer,
+                                        uint32_t imageIndex,
+                                        uint32_t frameDataOffset) {
+  if (!cachedCommands.empty()) {
+    VkCommandBuffer cached = getCachedCommandBuffer(imageIndex, frameDataOffset);
+    vkCmdExecuteCommands(commandBuffer, 1, &cached);
+  } else if (recordPool) {
+    recordSecondaryCommandBuffers(commandBuffer, imageIndex, frameDataOffset);
+  } else {
+    recordDraws(commandBuffer, 0, device.getConfig().scene.drawCount,
+                frameDataOffset);
+  }
+}
+
+bool VulkanRenderer::usesSecondaries() const {
+  // Decided by the config: the graph is built before the secondary command
+  // buffers are created.
+  const DeviceConfig &config = device.getConfig();
+  return config.cacheCommandBuffers || config.recordThreads > 0;
+}
+
+void VulkanRenderer::recordSecondaryCommandBuffers(VkCommandBuffer primary,
+                                                   uint32_t imageIndex,
+                                                   uint32_t frameDataOffset) {
+  uint32_t threadCount = recordPool->getThreadCount();
+  uint32_t drawCount = device.getConfig().scene.drawCount;
+  uint32_t sliceSize = (drawCount + threadCount - 1) / threadCount;
+  std::vector<VkCommandBuffer> secondaries(threadCount);
+
+  recordPool->run([&](uint32_t worker) {
+    WorkerCommands &commands = workerCommands[currentFrame * threadCount + worker];
+    secondaries[worker] = commands.commandBuffer;
+
+    // Resetting the whole pool is cheaper than resetting its buffers one by
+    // one, and nothing else records into it.
+    vkResetCommandPool(device.getDevice(), commands.commandPool, 0);
+    beginSecondaryCommandBuffer(commands.commandBuffer, imageIndex,
+                                VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    uint32_t firstDraw = std::min(worker * sliceSize, drawCount);
+    uint32_t sliceDraws = std::min(sliceSize, drawCount - firstDraw);
+    recordDraws(commands.commandBuffer, firstDraw, sliceDraws, frameDataOffset);
+
+    if (vkEndCommandBuffer(commands.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record secondary command buffer!");
+    }
+  });
+
+  vkCmdExecuteCommands(primary, threadCount, secondaries.data());
+}
+
+VkCommandBuffer VulkanRenderer::getCachedCommandBuffer(uint32_t imageIndex,
+                                                       uint32_t frameDataOffset) {
+  CachedCommands &cached =
+      cachedCommands[currentFrame * swapChainImageViews.size() + imageIndex];
+
+  // Frame data is always the first allocation of a frame's ring region, so
+  // the baked offset stays valid unless the ring layout itself changes.
+  if (!cached.dirty && cached.frameDataOffset == frameDataOffset) {
+    return cached.commandBuffer;
+  }
+
+  // This frame's and the image's timeline values have both been waited on,
+  // so the previous submission of this buffer has completed.
+  vkResetCommandBuffer(cached.commandBuffer, 0);
+  beginSecondaryCommandBuffer(cached.commandBuffer, imageIndex, 0);
+  recordDraws(cached.commandBuffer, 0, device.getConfig().scene.drawCount,
+              frameDataOffset);
+  if (vkEndCommandBuffer(cached.commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record cached command buffer!");
+  }
+
+  cached.frameDataOffset = frameDataOffset;
+  cached.dirty = false;
+  return cached.commandBuffer;
+}
+
+void VulkanRenderer::invalidateRecordedCommands() {
+  for (auto &cached : cachedCommands) {
+    cached.dirty = true;
+  }
+}
+
+void VulkanRenderer::beginSecondaryCommandBuffer(VkCommandBuffer commandBuffer,
+                                                 uint32_t imageIndex,
+                                                 VkCommandBufferUsageFlags flags) {
+  VkCommandBufferInheritanceInfo inheritanceInfo{};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.pipelineStatistics =
+      device.getProfiler().getInheritedStatistics();
+
+  // With dynamic rendering there is no render pass to inherit, only the
+  // attachment formats the secondary will render to.
+  VkFormat colorFormat = device.getSwapChain().getSwapChainImageFormat();
+  VkCommandBufferInheritanceRenderingInfo renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+  renderingInfo.colorAttachmentCount = 1;
+  renderingInfo.pColorAttachmentFormats = &colorFormat;
+  renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  if (device.usesDynamicRendering()) {
+    inheritanceInfo.pNext = &renderingInfo;
+  } else {
+    inheritanceInfo.renderPass = device.getPipeLine().getRenderPass();
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+  }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | flags;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin recording secondary command buffer!");
+  }
+}
+
+void VulkanRenderer::recordDraws(VkCommandBuffer commandBuffer,
+                                 uint32_t firstDraw, uint32_t drawCount,
+                                 uint32_t frameDataOffset) {
+  // Secondary command buffers inherit none of this state from the primary.
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
@@ -97,65 +494,298 @@ void VulkanRenderer::recordCommandBuffer(VkCommandBuffer commandBuffer,
   scissor.extent = device.getSwapChain().getSwapChainExtent();
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-  vkCmdEndRenderPass(commandBuffer);
-
-  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to record command buffer!");
+  VulkanPipeLine &pipeLine = device.getPipeLine();
+  const VulkanMeshBuffer &meshBuffer = device.getMeshBuffer();
+  uint32_t boundPipeline = UINT32_MAX;
+
+  meshBuffer.bind(commandBuffer);
+
+  // All pipelines share one layout, so the sets stay bound across switches.
+  // Cached command buffers are kept per frame in flight, so baking this
+  // frame's instance region into them is safe.
+  const VulkanInstanceBuffer &instanceBuffer = device.getInstanceBuffer();
+  const VulkanCullingPass &cullingPass = device.getCullingPass();
+  VkDescriptorSet descriptorSets[] = {device.getUniformRing().getDescriptorSet(),
+                                      instanceBuffer.getDescriptorSet()};
+  uint32_t dynamicOffsets[] = {frameDataOffset,
+                               instanceBuffer.getDynamicOffset(currentFrame)};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipeLine.getPipelineLayout(), 0, 2, descriptorSets,
+                          2, dynamicOffsets);
+
+  VulkanPipeLine::DrawConstants drawConstants;
+  drawConstants.instanceCount = instanceBuffer.getInstanceCount();
+
+  for (uint32_t draw = firstDraw; draw < firstDraw + drawCount; draw++) {
+    uint32_t pipeline = draw % pipeLine.getPipelineCount();
+    if (pipeline != boundPipeline) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        pipeLine.getGraphicsPipeline(pipeline));
+      boundPipeline = pipeline;
+    }
+    vkCmdPushConstants(commandBuffer, pipeLine.getPipelineLayout(),
+                       VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(drawConstants),
+                       &drawConstants);
+    if (cullingPass.isEnabled()) {
+      cullingPass.draw(commandBuffer, currentFrame);
+    } else {
+      vkCmdDrawIndexed(commandBuffer, meshBuffer.getIndexCount(),
+                       drawConstants.instanceCount, 0, 0, 0);
+    }
   }
 }
 
 void VulkanRenderer::createSyncObjects() {
+  // Frames are paced on the graphics timeline; only the swap chain, which
+  // cannot signal or wait on timelines, still needs binary semaphores.
+  imageAvailableSemaphores.resize(framesInFlight);
+  frameValues.assign(framesInFlight, 0);
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  for (uint32_t i = 0; i < framesInFlight; i++) {
+    if (vkCreateSemaphore(device.getDevice(), &semaphoreInfo,
+                          device.getAllocationCallbacks(),
+                          &imageAvailableSemaphores[i]) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create synchronization objects for a frame!");
+    }
+  }
+
+  createImageSyncObjects();
+}
+
+void VulkanRenderer::createImageSyncObjects() {
+  renderFinishedSemaphores.resize(device.isHeadless() ? 0 : swapChainImageViews.size());
+  presentFences.resize(device.hasPresentFences() ? swapChainImageViews.size() : 0);
+  imageValues.assign(swapChainImageViews.size(), 0);
+
   VkSemaphoreCreateInfo semaphoreInfo{};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
+  for (auto &semaphore : renderFinishedSemaphores) {
+    if (vkCreateSemaphore(device.getDevice(), &semaphoreInfo,
+                          device.getAllocationCallbacks(),
+                          &semaphore) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create semaphore!");
+    }
+  }
+
+  // Signaled, so the first present of each image does not wait.
   VkFenceCreateInfo fenceInfo{};
   fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
   fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-  if (vkCreateSemaphore(device.getDevice(), &semaphoreInfo, nullptr,
-                        &imageAvailabeSemaphore) != VK_SUCCESS ||
-      vkCreateSemaphore(device.getDevice(), &semaphoreInfo, nullptr,
-                        &renderFinishedSemaphore) != VK_SUCCESS ||
-      vkCreateFence(device.getDevice(), &fenceInfo, nullptr, &inFlightFence) !=
-          VK_SUCCESS) {
-    throw std::runtime_error("failed to create semaphore!");
+  for (auto &fence : presentFences) {
+    if (vkCreateFence(device.getDevice(), &fenceInfo,
+                      device.getAllocationCallbacks(), &fence) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create present fence!");
+    }
+  }
+}
+
+void VulkanRenderer::destroyImageSyncObjects() {
+  if (!presentFences.empty()) {
+    vkWaitForFences(device.getDevice(),
+                    static_cast<uint32_t>(presentFences.size()),
+                    presentFences.data(), VK_TRUE, UINT64_MAX);
+  }
+  for (auto fence : presentFences) {
+    vkDestroyFence(device.getDevice(), fence, device.getAllocationCallbacks());
+  }
+  presentFences.clear();
+  for (auto semaphore : renderFinishedSemaphores) {
+    vkDestroySemaphore(device.getDevice(), semaphore,
+                       device.getAllocationCallbacks());
   }
+  renderFinishedSemaphores.clear();
+  imageValues.clear();
+}
+
+void VulkanRenderer::retireImageSyncObjects(
+    std::function<void()> destroyOldSwapChain) {
+  std::vector<VkSemaphore> semaphores = std::move(renderFinishedSemaphores);
+  renderFinishedSemaphores.clear();
+  imageValues.clear();
+
+  retireAfterPresents([this, semaphores, destroyOldSwapChain]() {
+    for (auto semaphore : semaphores) {
+      vkDestroySemaphore(device.getDevice(), semaphore,
+                         device.getAllocationCallbacks());
+    }
+    destroyOldSwapChain();
+  });
+}
+
+void VulkanRenderer::retireAfterPresents(std::function<void()> destroy) {
+  // Offscreen images are never presented; only frames use them.
+  if (device.isHeadless()) {
+    device.getQueueScheduler().deferDestroy(VulkanQueueScheduler::GRAPHICS,
+                                            std::move(destroy));
+    return;
+  }
+
+  // The fences of the images presented so far go with what they guard; the
+  // images that come next get their own.
+  if (device.hasPresentFences()) {
+    std::vector<VkFence> fences = std::move(presentFences);
+    presentFences.clear();
+    retiredPresents.push_back({std::move(fences), std::move(destroy)});
+    return;
+  }
+
+  // Every present queued so far waited on a frame, so once they are done
+  // the frames are too; the graphics timeline still covers the frame
+  // capture reading the old images.
+  vkQueueWaitIdle(device.getPresentQueue());
+  device.getQueueScheduler().deferDestroy(VulkanQueueScheduler::GRAPHICS,
+                                          std::move(destroy));
+}
+
+void VulkanRenderer::collectRetiredPresents(bool wait) {
+  size_t done = 0;
+  for (auto &retired : retiredPresents) {
+    uint32_t fenceCount = static_cast<uint32_t>(retired.fences.size());
+    if (fenceCount > 0 &&
+        vkWaitForFences(device.getDevice(), fenceCount, retired.fences.data(),
+                        VK_TRUE, wait ? UINT64_MAX : 0) != VK_SUCCESS) {
+      break;
+    }
+    for (auto fence : retired.fences) {
+      vkDestroyFence(device.getDevice(), fence,
+                     device.getAllocationCallbacks());
+    }
+    retired.destroy();
+    done++;
+  }
+  retiredPresents.erase(retiredPresents.begin(), retiredPresents.begin() + done);
 }
 
 void VulkanRenderer::drawFrame() {
-  vkWaitForFences(device.getDevice(), 1, &inFlightFence, VK_TRUE, UINT64_MAX);
-  vkResetFences(device.getDevice(), 1, &inFlightFence);
+  frameStats.beginFrame();
+  device.getHostAllocator().beginFrame();
+
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  scheduler.wait(VulkanQueueScheduler::GRAPHICS, frameValues[currentFrame]);
+  scheduler.collectGarbage();
+  collectRetiredPresents(false);
+  device.getMemoryAllocator().updateBudget();
+  // Cached recordings hold the fallback for variants that just came in.
+  if (device.getPipeLine().refreshPipelines()) {
+    invalidateRecordedCommands();
+  }
+  device.getUniformRing().beginFrame(currentFrame);
+  device.getInstanceBuffer().update(currentFrame);
+  frameStats.endStage(FrameStats::WAIT);
 
   uint32_t imageIndex;
-  vkAcquireNextImageKHR(device.getDevice(), device.getSwapChain().getSwapChain(),UINT64_MAX, imageAvailabeSemaphore, VK_NULL_HANDLE, &imageIndex);
+  if (!acquireImage(imageIndex)) {
+    return;
+  }
+  frameStats.endStage(FrameStats::ACQUIRE);
+
+  // The image may still be in use by an older frame when the swap chain has
+  // fewer images than frames in flight or hands them out of order.
+  scheduler.wait(VulkanQueueScheduler::GRAPHICS, imageValues[imageIndex]);
+  frameStats.endStage(FrameStats::WAIT);
+
+  VkCommandBuffer commandBuffer = commandBuffers[currentFrame];
   vkResetCommandBuffer(commandBuffer, 0);
   recordCommandBuffer(commandBuffer, imageIndex);
+  frameStats.endStage(FrameStats::RECORD);
+
+  submitFrame(commandBuffer, imageIndex);
+  device.getFrameCapture().submit(frameValues[currentFrame]);
+  lastImageIndex = imageIndex;
+  frameStats.endStage(FrameStats::SUBMIT);
+
+  presentImage(imageIndex);
+  frameStats.endStage(FrameStats::PRESENT);
+
+  currentFrame = (currentFrame + 1) % framesInFlight;
+  frameStats.endFrame();
+}
+
+bool VulkanRenderer::acquireImage(uint32_t &imageIndex) {
+  if (device.isHeadless()) {
+    imageIndex = nextOffscreenImage;
+    nextOffscreenImage = (nextOffscreenImage + 1) %
+                         static_cast<uint32_t>(swapChainImageViews.size());
+    return true;
+  }
+
+  VkResult result = vkAcquireNextImageKHR(device.getDevice(), device.getSwapChain().getSwapChain(), UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+  // A suboptimal image was still acquired and its semaphore will be
+  // signaled, so it is rendered and presented; the rebuild follows present.
+  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+    recreateSwapChain();
+    return false;
+  }
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+    throw std::runtime_error("failed to acquire swap chain image!");
+  }
+  return true;
+}
 
+void VulkanRenderer::submitFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-  VkSemaphore waitSemaphores[] = {imageAvailabeSemaphore};
-  VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffer;
 
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
+  // Offscreen images are neither acquired nor presented, so a headless frame
+  // only waits on work handed over from other queues and signals its
+  // timeline value. Binary semaphores ignore their entry in the value lists.
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<uint64_t> waitValues;
+  std::vector<VkPipelineStageFlags> waitStages;
+  if (!device.isHeadless()) {
+    waitSemaphores.push_back(imageAvailableSemaphores[currentFrame]);
+    waitValues.push_back(0);
+    waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  }
+  scheduler.takeGraphicsWaits(waitSemaphores, waitValues, waitStages);
+
+  uint64_t frameValue = scheduler.nextValue(VulkanQueueScheduler::GRAPHICS);
+  std::vector<VkSemaphore> signalSemaphores = {
+      scheduler.getTimeline(VulkanQueueScheduler::GRAPHICS)};
+  std::vector<uint64_t> signalValues = {frameValue};
+  if (!device.isHeadless()) {
+    signalSemaphores.push_back(renderFinishedSemaphores[imageIndex]);
+    signalValues.push_back(0);
+  }
 
-  if (vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, inFlightFence) != VK_SUCCESS) {
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
+  submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+  submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+  if (vkQueueSubmit(device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
     throw std::runtime_error("failed to submit draw command buffer!");
   }
+  frameValues[currentFrame] = frameValue;
+  imageValues[imageIndex] = frameValue;
+}
+
+void VulkanRenderer::presentImage(uint32_t imageIndex) {
+  if (device.isHeadless()) return;
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
+  presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
 
   VkSwapchainKHR swapChains[] = {device.getSwapChain().getSwapChain()};
   presentInfo.swapchainCount = 1;
@@ -164,16 +794,96 @@ void VulkanRenderer::drawFrame() {
 
   presentInfo.pResults = nullptr;
 
-  vkQueuePresentKHR(device.getPresentQueue(), &presentInfo);
+  // Signaled once the present is done with the semaphore and the image.
+  VkSwapchainPresentFenceInfoEXT presentFenceInfo{};
+  if (!presentFences.empty()) {
+    VkFence &fence = presentFences[imageIndex];
+    vkWaitForFences(device.getDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(device.getDevice(), 1, &fence);
+    presentFenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+    presentFenceInfo.swapchainCount = 1;
+    presentFenceInfo.pFences = &fence;
+    presentInfo.pNext = &presentFenceInfo;
+  }
+
+  VkResult result = vkQueuePresentKHR(device.getPresentQueue(), &presentInfo);
+
+  Window &window = device.getWindow();
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
+      window.wasResized()) {
+    window.resetResized();
+    recreateSwapChain();
+  } else if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to present swap chain image!");
+  }
+}
+
+void VulkanRenderer::recreateSwapChain() {
+  device.getWindow().waitWhileMinimized();
+
+  // Frames in flight keep rendering to and presenting the old images, so
+  // the device is not waited for: what the frames use is retired on the
+  // graphics timeline, and what the presents use once they are done.
+  retireFramebuffers();
+  std::function<void()> destroyOldSwapChain = device.getSwapChain().recreate();
+  device.getFrameCapture().checkExtent();
+  createFramebuffers();
+
+  // Cached commands reference the old framebuffers.
+  if (!cachedCommands.empty()) {
+    retireCachedCommandBuffers();
+    createCachedCommandBuffers();
+  }
+
+  // Presents of the old images may still wait on their semaphores, and the
+  // new swap chain may have a different number of images.
+  retireImageSyncObjects(std::move(destroyOldSwapChain));
+  createImageSyncObjects();
 }
 
 void VulkanRenderer::cleanup() {
-  vkDestroySemaphore(device.getDevice(), imageAvailabeSemaphore, nullptr);
-  vkDestroySemaphore(device.getDevice(), renderFinishedSemaphore, nullptr);
-  vkDestroyFence(device.getDevice(), inFlightFence, nullptr);
-  vkDestroyCommandPool(device.getDevice(), commandPool, nullptr);
+  for (uint32_t i = 0; i < framesInFlight; i++) {
+    vkDestroySemaphore(device.getDevice(), imageAvailableSemaphores[i],
+                       device.getAllocationCallbacks());
+  }
+  imageAvailableSemaphores.clear();
+  frameValues.clear();
+  collectRetiredPresents(true);
+  destroyImageSyncObjects();
+  destroyCachedCommandBuffers();
+  vkDestroyCommandPool(device.getDevice(), commandPool,
+                       device.getAllocationCallbacks());
+  commandBuffers.clear();
+  for (auto &commands : workerCommands) {
+    vkDestroyCommandPool(device.getDevice(), commands.commandPool,
+                         device.getAllocationCallbacks());
+  }
+  workerCommands.clear();
+  recordPool.reset();
+  destroyFramebuffers();
+}
+
+void VulkanRenderer::retireFramebuffers() {
+  renderGraph.retire();
+
+  std::vector<VkFramebuffer> framebuffers = std::move(swapChainFramebuffers);
+  swapChainFramebuffers.clear();
+  if (framebuffers.empty()) return;
+
+  device.getQueueScheduler().deferDestroy(
+      VulkanQueueScheduler::GRAPHICS, [this, framebuffers]() {
+        for (auto framebuffer : framebuffers) {
+          vkDestroyFramebuffer(device.getDevice(), framebuffer,
+                               device.getAllocationCallbacks());
+        }
+      });
+}
+
+void VulkanRenderer::destroyFramebuffers() {
+  renderGraph.cleanup();
   for (auto framebuffer : swapChainFramebuffers) {
-    vkDestroyFramebuffer(device.getDevice(), framebuffer, nullptr);
+    vkDestroyFramebuffer(device.getDevice(), framebuffer,
+                         device.getAllocationCallbacks());
   }
   swapChainFramebuffers.clear();
 }
@@ -1,7 +1,12 @@
 #ifndef VULKAN_RENDERER_H
 #define VULKAN_RENDERER_H
 
+#include "FrameStats.h"
+#include "ThreadPool.h"
+#include "VulkanRenderGraph.h"
 #include <vulkan/vulkan.h>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <stdexcept>
 
@@ -10,26 +15,146 @@ class VulkanDevice;
 class VulkanRenderer {
 
 public:
-  VulkanRenderer(VulkanDevice &device);
+  static constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+  VulkanRenderer(VulkanDevice &device,
+                 uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT);
 
   void createFramebuffers();
   void createCommandPool();
-  void createCommandBuffer();
+  void createCommandBuffers();
+  // Switches recording to threadCount workers that each fill a secondary
+  // command buffer with a slice of the draws.
+  void createWorkerCommandPools(uint32_t threadCount);
+  // Switches to replaying draws recorded once per swap chain image and frame
+  // in flight, re-recording only what invalidateRecordedCommands() marked.
+  void createCachedCommandBuffers();
+  // Call after changing pipelines or the draw list; swap chain recreation
+  // invalidates on its own.
+  void invalidateRecordedCommands();
   void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
   void createSyncObjects();
   void drawFrame();
+  // Rebuilds everything that depends on the swap chain images, leaving the
+  // render pass and pipelines alone since viewport and scissor are dynamic.
+  void recreateSwapChain();
   void cleanup();
 
+  uint32_t getFramesInFlight() const { return framesInFlight; }
+  uint32_t getCurrentFrame() const { return currentFrame; }
+  // Swap chain image the last submitted frame rendered to.
+  uint32_t getLastImageIndex() const { return lastImageIndex; }
+  FrameStats &getFrameStats() { return frameStats; }
+
 private:
   VulkanDevice &device;
 
+  // Returns false when the swap chain is out of date and had to be rebuilt,
+  // in which case the frame is skipped.
+  bool acquireImage(uint32_t &imageIndex);
+  void recordDraws(VkCommandBuffer commandBuffer, uint32_t firstDraw,
+                   uint32_t drawCount, uint32_t frameDataOffset);
+  // The frame as one hand-written render pass over a framebuffer.
+  void recordRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                        uint32_t frameDataOffset);
+  // The frame as a render graph, with dynamic rendering.
+  void buildRenderGraph();
+  void recordRenderGraph(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                         uint32_t frameDataOffset);
+  // The draws inside the pass over the swap chain image, inline or from
+  // secondary command buffers.
+  void recordPassContents(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                          uint32_t frameDataOffset);
+  bool usesSecondaries() const;
+  void recordSecondaryCommandBuffers(VkCommandBuffer primary,
+                                     uint32_t imageIndex,
+                                     uint32_t frameDataOffset);
+  void beginSecondaryCommandBuffer(VkCommandBuffer commandBuffer,
+                                   uint32_t imageIndex,
+                                   VkCommandBufferUsageFlags flags);
+  VkCommandBuffer getCachedCommandBuffer(uint32_t imageIndex,
+                                         uint32_t frameDataOffset);
+  void destroyCachedCommandBuffers();
+  // The retire*() variants leave destruction to the graphics timeline, for
+  // objects frames in flight may still be using.
+  void retireCachedCommandBuffers();
+  void submitFrame(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+  void presentImage(uint32_t imageIndex);
+  void createImageSyncObjects();
+  void destroyImageSyncObjects();
+  // Retires the per-image semaphores and present fences together with
+  // destroyOldSwapChain, see retireAfterPresents().
+  void retireImageSyncObjects(std::function<void()> destroyOldSwapChain);
+  // Runs destroy once every present queued so far is done with its
+  // semaphore and swap chain. The graphics timeline only says the frame
+  // before the present finished, so without present fences this waits for
+  // the present queue to go idle.
+  void retireAfterPresents(std::function<void()> destroy);
+  // Runs what retireAfterPresents() queued whose presents are done; wait
+  // blocks until all of them are.
+  void collectRetiredPresents(bool wait);
+  void destroyFramebuffers();
+  void retireFramebuffers();
+
+  uint32_t framesInFlight;
+  uint32_t currentFrame = 0;
+  uint32_t nextOffscreenImage = 0;
+  uint32_t lastImageIndex = 0;
+
+  FrameStats frameStats;
+
+  // Only used with dynamic rendering. The graph's passes record for the
+  // image and frame data set before execute().
+  VulkanRenderGraph renderGraph;
+  VulkanRenderGraph::Resource swapChainTarget = 0;
+  VulkanRenderGraph::Resource drawCommandsTarget = 0;
+  uint32_t graphImageIndex = 0;
+  uint32_t graphFrameDataOffset = 0;
+
   VkCommandPool commandPool;
-  VkCommandBuffer commandBuffer;
+  std::vector<VkCommandBuffer> commandBuffers;
+
+  struct WorkerCommands {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+  };
+  // Empty unless recording is multithreaded; indexed by
+  // frame * thread count + worker.
+  std::unique_ptr<ThreadPool> recordPool;
+  std::vector<WorkerCommands> workerCommands;
+
+  struct CachedCommands {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    uint32_t frameDataOffset = 0;
+    bool dirty = true;
+  };
+  // Empty unless command caching is on; indexed by
+  // frame * swap chain image count + image.
+  std::vector<CachedCommands> cachedCommands;
+  std::vector<VkImage> swapChainImages;
   std::vector<VkImageView> swapChainImageViews;
+  // Empty with dynamic rendering.
   std::vector<VkFramebuffer> swapChainFramebuffers;
-  VkSemaphore imageAvailabeSemaphore;
-  VkSemaphore renderFinishedSemaphore;
-  VkFence inFlightFence;
+
+  // Indexed by frame in flight. frameValues holds the graphics timeline value
+  // each frame's last submission signals; 0 means nothing to wait for.
+  std::vector<VkSemaphore> imageAvailableSemaphores;
+  std::vector<uint64_t> frameValues;
+
+  // Indexed by swap chain image. Without present fences presentation has no
+  // completion signal of its own, so the semaphore it waits on is only safe
+  // to reuse once the same image has been acquired again. presentFences is
+  // empty unless the device has them.
+  std::vector<VkSemaphore> renderFinishedSemaphores;
+  std::vector<VkFence> presentFences;
+  std::vector<uint64_t> imageValues;
+
+  struct RetiredPresents {
+    std::vector<VkFence> fences;
+    std::function<void()> destroy;
+  };
+  // What retireAfterPresents() holds back, oldest first.
+  std::vector<RetiredPresents> retiredPresents;
 };
 
 #endif
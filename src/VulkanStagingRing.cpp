@@ -0,0 +1,188 @@
+#include "VulkanStagingRing.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+VulkanStagingRing::VulkanStagingRing(VulkanDevice &device) : device(device) {}
+
+void VulkanStagingRing::create(VkDeviceSize size) {
+  segmentSize = size / SEGMENT_COUNT;
+  ringSize = segmentSize * SEGMENT_COUNT;
+  createBuffer();
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                   VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex =
+      device.findQueueFamilies(device.getPhysicalDevice()).transferFamily.value();
+
+  if (vkCreateCommandPool(device.getDevice(), &poolInfo,
+                          device.getAllocationCallbacks(), &commandPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create staging command pool!");
+  }
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = 1;
+
+  for (auto &segment : segments) {
+    if (vkAllocateCommandBuffers(device.getDevice(), &allocInfo,
+                                 &segment.commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create staging segment!");
+    }
+  }
+
+  VulkanMemoryAllocator &allocator = device.getMemoryAllocator();
+  pressureCallbackId = allocator.addPressureCallback(
+      [this, &allocator](uint32_t heap,
+                         const VulkanMemoryAllocator::HeapBudget &) {
+        if (buffer != VK_NULL_HANDLE &&
+            allocator.heapOf(allocation.memoryType) == heap) {
+          releaseBuffer();
+        }
+      });
+}
+
+void VulkanStagingRing::cleanup() {
+  if (commandPool == VK_NULL_HANDLE) return;
+
+  device.getMemoryAllocator().removePressureCallback(pressureCallbackId);
+
+  for (auto &segment : segments) {
+    segment = Segment();
+  }
+  vkDestroyCommandPool(device.getDevice(), commandPool,
+                       device.getAllocationCallbacks());
+  commandPool = VK_NULL_HANDLE;
+
+  if (buffer != VK_NULL_HANDLE) {
+    device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+    buffer = VK_NULL_HANDLE;
+    mapped = nullptr;
+  }
+}
+
+void VulkanStagingRing::createBuffer() {
+  device.createBuffer(ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      buffer, allocation);
+  mapped = static_cast<char *>(allocation.mapped);
+}
+
+void VulkanStagingRing::releaseBuffer() {
+  // Copies recorded so far still go out; the buffer goes once they are done.
+  Segment &segment = segments[currentSegment];
+  if (segment.recording) {
+    submitSegment(segment);
+    currentSegment = (currentSegment + 1) % SEGMENT_COUNT;
+  }
+
+  VkBuffer oldBuffer = buffer;
+  VulkanAllocation oldAllocation = allocation;
+  device.getQueueScheduler().deferDestroy(
+      VulkanQueueScheduler::TRANSFER, [this, oldBuffer, oldAllocation]() mutable {
+        device.getMemoryAllocator().destroyBuffer(oldBuffer, oldAllocation);
+      });
+  buffer = VK_NULL_HANDLE;
+  allocation = VulkanAllocation();
+  mapped = nullptr;
+}
+
+void VulkanStagingRing::upload(VkBuffer dst, VkDeviceSize dstOffset,
+                               const void *data, VkDeviceSize size) {
+  const char *bytes = static_cast<const char *>(data);
+  if (buffer == VK_NULL_HANDLE) {
+    createBuffer();
+  }
+
+  while (size > 0) {
+    Segment &segment = segments[currentSegment];
+    if (!segment.recording) {
+      beginSegment(segment);
+    }
+
+    VkDeviceSize chunk = std::min(size, segmentSize - segment.used);
+    if (chunk == 0) {
+      submitSegment(segment);
+      currentSegment = (currentSegment + 1) % SEGMENT_COUNT;
+      continue;
+    }
+
+    VkDeviceSize srcOffset = currentSegment * segmentSize + segment.used;
+    std::memcpy(mapped + srcOffset, bytes, chunk);
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = chunk;
+    vkCmdCopyBuffer(segment.commandBuffer, buffer, dst, 1, &copyRegion);
+
+    segment.used += chunk;
+    bytes += chunk;
+    dstOffset += chunk;
+    size -= chunk;
+  }
+}
+
+void VulkanStagingRing::flush() {
+  Segment &segment = segments[currentSegment];
+  if (segment.recording) {
+    submitSegment(segment);
+    currentSegment = (currentSegment + 1) % SEGMENT_COUNT;
+  }
+
+  // Timeline values complete in order, so the newest covers every segment.
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  scheduler.wait(VulkanQueueScheduler::TRANSFER,
+                 scheduler.getSubmittedValue(VulkanQueueScheduler::TRANSFER));
+}
+
+void VulkanStagingRing::beginSegment(Segment &segment) {
+  // The segment's memory may still be the source of an earlier copy.
+  device.getQueueScheduler().wait(VulkanQueueScheduler::TRANSFER, segment.value);
+  vkResetCommandBuffer(segment.commandBuffer, 0);
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(segment.commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin staging command buffer!");
+  }
+
+  segment.used = 0;
+  segment.recording = true;
+}
+
+void VulkanStagingRing::submitSegment(Segment &segment) {
+  if (vkEndCommandBuffer(segment.commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record staging command buffer!");
+  }
+
+  VulkanQueueScheduler &scheduler = device.getQueueScheduler();
+  segment.value = scheduler.nextValue(VulkanQueueScheduler::TRANSFER);
+  VkSemaphore timeline = scheduler.getTimeline(VulkanQueueScheduler::TRANSFER);
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &segment.value;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &segment.commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &timeline;
+
+  if (vkQueueSubmit(device.getTransferQueue(), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit staging copy!");
+  }
+  segment.recording = false;
+}
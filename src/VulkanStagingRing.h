@@ -0,0 +1,69 @@
+#ifndef VULKAN_STAGING_RING_H
+#define VULKAN_STAGING_RING_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <array>
+#include <vulkan/vulkan.h>
+
+// Host-visible staging memory for filling DEVICE_LOCAL buffers on the
+// transfer queue. The ring is split into segments that each record their own
+// copy commands: while one segment is being copied by the GPU the next one is
+// filled on the CPU, and a segment is only reused once the transfer timeline
+// reaches the value its copies signaled.
+//
+// Uploads mostly happen while loading, so when the ring's heap comes under
+// memory pressure the buffer is released once its pending copies are done,
+// and upload() creates it again when it is next needed. Uploads and the
+// pressure callback both run on the thread driving frames.
+class VulkanStagingRing {
+public:
+  static constexpr VkDeviceSize DEFAULT_SIZE = 4 * 1024 * 1024;
+  static constexpr uint32_t SEGMENT_COUNT = 2;
+
+  VulkanStagingRing(VulkanDevice &device);
+
+  VulkanStagingRing(const VulkanStagingRing &) = delete;
+  VulkanStagingRing &operator=(const VulkanStagingRing &) = delete;
+
+  void create(VkDeviceSize size = DEFAULT_SIZE);
+  void cleanup();
+
+  // Copies size bytes into dst at dstOffset, in as many pieces as the ring
+  // needs. The destination is only valid to use after flush().
+  void upload(VkBuffer dst, VkDeviceSize dstOffset, const void *data,
+              VkDeviceSize size);
+  // Submits whatever is recorded and waits for every pending copy.
+  void flush();
+
+private:
+  struct Segment {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // Transfer timeline value of the segment's last submission.
+    uint64_t value = 0;
+    VkDeviceSize used = 0;
+    bool recording = false;
+  };
+
+  VulkanDevice &device;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VulkanAllocation allocation;
+  char *mapped = nullptr;
+  VkDeviceSize segmentSize = 0;
+
+  VkDeviceSize ringSize = 0;
+  uint32_t pressureCallbackId = 0;
+
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  std::array<Segment, SEGMENT_COUNT> segments;
+  uint32_t currentSegment = 0;
+
+  void createBuffer();
+  // Submits what is recorded and frees the buffer once the transfer
+  // timeline is past it, without waiting; the ring stays usable.
+  void releaseBuffer();
+  void beginSegment(Segment &segment);
+  void submitSegment(Segment &segment);
+};
+
+#endif
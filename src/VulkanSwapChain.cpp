@@ -11,9 +11,11 @@ VulkanSwapChain::VulkanSwapChain(VulkanDevice& device) : device(device) {}
 VulkanSwapChain::~VulkanSwapChain() {
   if (swapChain != VK_NULL_HANDLE) {
     for (auto imageView : swapChainImageViews) {
-      vkDestroyImageView(device.getDevice(), imageView, nullptr);
+      vkDestroyImageView(device.getDevice(), imageView,
+                         device.getAllocationCallbacks());
     }
-    vkDestroySwapchainKHR(device.getDevice(), swapChain, nullptr);
+    vkDestroySwapchainKHR(device.getDevice(), swapChain,
+                          device.getAllocationCallbacks());
   }
 }
 
@@ -82,7 +84,12 @@ VkExtent2D VulkanSwapChain::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& cap
   }
 }
 
-void VulkanSwapChain::createSwapChain() {
+void VulkanSwapChain::createSwapChain(VkSwapchainKHR oldSwapChain) {
+  if (device.isHeadless()) {
+    createOffscreenImages();
+    return;
+  }
+
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device.getPhysicalDevice());
 
 
@@ -105,6 +112,12 @@ void VulkanSwapChain::createSwapChain() {
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // Frame capture copies the rendered images out before presenting them.
+  if (!device.getConfig().capturePath.empty() &&
+      (swapChainSupport.capabilities.supportedUsageFlags &
+       VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
 
   VulkanDevice::QueueFamilyIndices indices = device.findQueueFamilies(device.getPhysicalDevice());
   uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -122,11 +135,16 @@ void VulkanSwapChain::createSwapChain() {
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  // Lets the presentation engine hand images of the retired swap chain over
+  // to the new one instead of allocating everything from scratch.
+  createInfo.oldSwapchain = oldSwapChain;
 
-  if (vkCreateSwapchainKHR(device.getDevice(), &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+  VkSwapchainKHR newSwapChain;
+  if (vkCreateSwapchainKHR(device.getDevice(), &createInfo,
+                           device.getAllocationCallbacks(), &newSwapChain) != VK_SUCCESS) {
     throw std::runtime_error("failed to create swap chain!");
   }
+  swapChain = newSwapChain;
 
   vkGetSwapchainImagesKHR(device.getDevice(), swapChain, &imageCount, nullptr);
   swapChainImages.resize(imageCount);
@@ -134,6 +152,46 @@ void VulkanSwapChain::createSwapChain() {
 
   swapChainImageFormat = surfaceFormat.format;
   swapChainExtent = extent;
+  swapChainImageUsage = createInfo.imageUsage;
+}
+
+void VulkanSwapChain::createOffscreenImages() {
+  // One image more than frames in flight, mirroring the minImageCount + 1
+  // request made of a real swap chain.
+  uint32_t imageCount = device.getRenderer().getFramesInFlight() + 1;
+
+  swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  swapChainExtent = device.getOffscreenExtent();
+  swapChainImageUsage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  swapChainImages.resize(imageCount);
+  offscreenImageMemory.resize(imageCount);
+
+  for (uint32_t i = 0; i < imageCount; i++) {
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = swapChainImageFormat;
+    imageInfo.extent = {swapChainExtent.width, swapChainExtent.height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = swapChainImageUsage;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    device.getMemoryAllocator().createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                            swapChainImages[i], offscreenImageMemory[i]);
+  }
+}
+
+void VulkanSwapChain::destroyOffscreenImages() {
+  for (size_t i = 0; i < offscreenImageMemory.size(); i++) {
+    device.getMemoryAllocator().destroyImage(swapChainImages[i], offscreenImageMemory[i]);
+  }
+  offscreenImageMemory.clear();
+  swapChainImages.clear();
 }
 
 void VulkanSwapChain::createImageViews() {
@@ -157,17 +215,60 @@ void VulkanSwapChain::createImageViews() {
     createInfo.subresourceRange.baseArrayLayer = 0;
     createInfo.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(device.getDevice(), &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
+    if (vkCreateImageView(device.getDevice(), &createInfo,
+                          device.getAllocationCallbacks(), &swapChainImageViews[i]) != VK_SUCCESS) {
       throw std::runtime_error("failed to create image views!");
     }
   }
 }
 
+std::function<void()> VulkanSwapChain::recreate() {
+  std::vector<VkImageView> oldImageViews = std::move(swapChainImageViews);
+  swapChainImageViews.clear();
+  VkSwapchainKHR oldSwapChain = swapChain;
+  // Offscreen images are owned here; swap chain images go with the chain.
+  std::vector<VkImage> oldImages;
+  std::vector<VulkanAllocation> oldImageMemory;
+
+  if (device.isHeadless()) {
+    oldImages = std::move(swapChainImages);
+    oldImageMemory = std::move(offscreenImageMemory);
+    swapChainImages.clear();
+    offscreenImageMemory.clear();
+    createSwapChain();
+  } else {
+    createSwapChain(oldSwapChain);
+  }
+
+  createImageViews();
+
+  return [this, oldImageViews, oldSwapChain, oldImages,
+          oldImageMemory]() mutable {
+    for (auto imageView : oldImageViews) {
+      vkDestroyImageView(device.getDevice(), imageView,
+                         device.getAllocationCallbacks());
+    }
+    for (size_t i = 0; i < oldImageMemory.size(); i++) {
+      device.getMemoryAllocator().destroyImage(oldImages[i], oldImageMemory[i]);
+    }
+    if (oldSwapChain != VK_NULL_HANDLE) {
+      vkDestroySwapchainKHR(device.getDevice(), oldSwapChain,
+                            device.getAllocationCallbacks());
+    }
+  };
+}
+
 void VulkanSwapChain::cleanup() {
   for (auto imageView : swapChainImageViews) {
-    vkDestroyImageView(device.getDevice(), imageView, nullptr);
+    vkDestroyImageView(device.getDevice(), imageView,
+                       device.getAllocationCallbacks());
   }
   swapChainImageViews.clear();
-  vkDestroySwapchainKHR(device.getDevice(), swapChain, nullptr);
+  if (device.isHeadless()) {
+    destroyOffscreenImages();
+    return;
+  }
+  vkDestroySwapchainKHR(device.getDevice(), swapChain,
+                        device.getAllocationCallbacks());
   swapChain = VK_NULL_HANDLE;
 }
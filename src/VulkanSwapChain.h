@@ -3,6 +3,8 @@
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include "VulkanMemoryAllocator.h"
+#include <functional>
 #include <vector>
 
 class VulkanDevice;
@@ -18,8 +20,14 @@ public:
   VulkanSwapChain(VulkanDevice &device);
   ~VulkanSwapChain();
 
-  void createSwapChain();
+  void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE);
   void createImageViews();
+  // Rebuilds the swap chain and its image views for the current surface size.
+  // Frames in flight and queued presents may still use the old images, so
+  // their destruction, along with that of their views and the old swap
+  // chain, is returned for the renderer to run once presentation is done
+  // with them.
+  std::function<void()> recreate();
   void cleanup();
 
   VulkanSwapChain(const VulkanSwapChain &) = delete;
@@ -28,17 +36,26 @@ public:
   VkSwapchainKHR getSwapChain() const { return swapChain; }
   VkFormat getSwapChainImageFormat() const { return swapChainImageFormat; }
   VkExtent2D getSwapChainExtent() const { return swapChainExtent; }
+  VkImageUsageFlags getImageUsage() const { return swapChainImageUsage; }
   std::vector<VkImageView> getSwapChainImageViews() const { return swapChainImageViews; }
+  std::vector<VkImage> getSwapChainImages() const { return swapChainImages; }
 
 private:
   VulkanDevice &device;
 
-  VkSwapchainKHR swapChain;
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
   std::vector<VkImage> swapChainImages;
+  // Backing memory for the offscreen images used in place of swap chain
+  // images on a headless device.
+  std::vector<VulkanAllocation> offscreenImageMemory;
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
+  VkImageUsageFlags swapChainImageUsage = 0;
   std::vector<VkImageView> swapChainImageViews;
 
+  void createOffscreenImages();
+  void destroyOffscreenImages();
+
   SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
   VkSurfaceFormatKHR chooseSwapSurfaceFormat(
       const std::vector<VkSurfaceFormatKHR> &availableFormats);
@@ -0,0 +1,125 @@
+#include "VulkanUniformRing.h"
+#include "VulkanDevice.h"
+#include <algorithm>
+#include <stdexcept>
+
+VulkanUniformRing::VulkanUniformRing(VulkanDevice &device) : device(device) {}
+
+void VulkanUniformRing::create(uint32_t framesInFlight, VkDeviceSize frameSize) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &properties);
+  // Both limits are powers of two, so the larger one satisfies either use.
+  alignment = std::max(properties.limits.minUniformBufferOffsetAlignment,
+                       properties.limits.minStorageBufferOffsetAlignment);
+  this->frameSize = (frameSize + alignment - 1) & ~(alignment - 1);
+
+  // The descriptor always reads BINDING_RANGE bytes from the dynamic offset,
+  // so the last region needs that much slack behind it.
+  device.createBuffer(this->frameSize * framesInFlight + BINDING_RANGE,
+                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      buffer, allocation);
+
+  createDescriptorSetLayout();
+  createDescriptorSet();
+  beginFrame(0);
+}
+
+void VulkanUniformRing::createDescriptorSetLayout() {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+
+  if (vkCreateDescriptorSetLayout(device.getDevice(), &layoutInfo,
+                                  device.getAllocationCallbacks(),
+                                  &descriptorSetLayout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor set layout!");
+  }
+}
+
+void VulkanUniformRing::createDescriptorSet() {
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(device.getDevice(), &poolInfo,
+                             device.getAllocationCallbacks(),
+                             &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create descriptor pool!");
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &descriptorSetLayout;
+
+  if (vkAllocateDescriptorSets(device.getDevice(), &allocInfo,
+                               &descriptorSet) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate descriptor set!");
+  }
+
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = BINDING_RANGE;
+
+  VkWriteDescriptorSet descriptorWrite{};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = descriptorSet;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = 0;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pBufferInfo = &bufferInfo;
+
+  vkUpdateDescriptorSets(device.getDevice(), 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanUniformRing::cleanup() {
+  if (buffer == VK_NULL_HANDLE) return;
+
+  vkDestroyDescriptorPool(device.getDevice(), descriptorPool,
+                          device.getAllocationCallbacks());
+  vkDestroyDescriptorSetLayout(device.getDevice(), descriptorSetLayout,
+                               device.getAllocationCallbacks());
+  descriptorPool = VK_NULL_HANDLE;
+  descriptorSetLayout = VK_NULL_HANDLE;
+  descriptorSet = VK_NULL_HANDLE;
+
+  device.getMemoryAllocator().destroyBuffer(buffer, allocation);
+  buffer = VK_NULL_HANDLE;
+}
+
+void VulkanUniformRing::beginFrame(uint32_t frame) {
+  frameStart = frame * frameSize;
+  head = frameStart;
+}
+
+void *VulkanUniformRing::allocate(VkDeviceSize size, uint32_t &dynamicOffset) {
+  if (size > BINDING_RANGE) {
+    throw std::runtime_error("uniform ring allocation exceeds the binding range!");
+  }
+  if (head + size > frameStart + frameSize) {
+    throw std::runtime_error("uniform ring exhausted for this frame!");
+  }
+
+  dynamicOffset = static_cast<uint32_t>(head);
+  head = (head + size + alignment - 1) & ~(alignment - 1);
+  return static_cast<char *>(allocation.mapped) + dynamicOffset;
+}
@@ -0,0 +1,63 @@
+#ifndef VULKAN_UNIFORM_RING_H
+#define VULKAN_UNIFORM_RING_H
+
+class VulkanDevice;
+#include "VulkanMemoryAllocator.h"
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Persistently mapped, host-visible buffer for data that changes every frame.
+// Each frame in flight owns one region that is filled front to back with a
+// pointer bump and rewound once the frame's submission has completed. A single
+// UNIFORM_BUFFER_DYNAMIC descriptor covers the whole buffer, so per-draw or
+// per-frame data is selected with a dynamic offset at bind time instead of
+// allocating or updating descriptor sets.
+class VulkanUniformRing {
+public:
+  static constexpr VkDeviceSize DEFAULT_FRAME_SIZE = 256 * 1024;
+  // Largest block that can be read through the dynamic descriptor.
+  static constexpr VkDeviceSize BINDING_RANGE = 1024;
+
+  VulkanUniformRing(VulkanDevice &device);
+
+  VulkanUniformRing(const VulkanUniformRing &) = delete;
+  VulkanUniformRing &operator=(const VulkanUniformRing &) = delete;
+
+  void create(uint32_t framesInFlight, VkDeviceSize frameSize = DEFAULT_FRAME_SIZE);
+  void cleanup();
+
+  // Rewinds the region of the given frame; its submission must have completed.
+  void beginFrame(uint32_t frame);
+  // Returns where to write size bytes and the matching dynamic offset.
+  void *allocate(VkDeviceSize size, uint32_t &dynamicOffset);
+
+  template <typename T> uint32_t push(const T &data) {
+    static_assert(sizeof(T) <= BINDING_RANGE, "uniform block too large");
+    uint32_t dynamicOffset;
+    std::memcpy(allocate(sizeof(T), dynamicOffset), &data, sizeof(T));
+    return dynamicOffset;
+  }
+
+  VkDescriptorSetLayout getDescriptorSetLayout() const { return descriptorSetLayout; }
+  VkDescriptorSet getDescriptorSet() const { return descriptorSet; }
+
+private:
+  VulkanDevice &device;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VulkanAllocation allocation;
+  VkDeviceSize frameSize = 0;
+  VkDeviceSize alignment = 1;
+  VkDeviceSize frameStart = 0;
+  VkDeviceSize head = 0;
+
+  VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+  void createDescriptorSetLayout();
+  void createDescriptorSet();
+};
+
+#endif
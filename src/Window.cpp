@@ -19,7 +19,6 @@ void Window::initWindow() {
   }
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
   window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
 
@@ -27,8 +26,28 @@ void Window::initWindow() {
     glfwTerminate();
     throw std::runtime_error("Failed to create GLFW window");
   }
+
+  glfwSetWindowUserPointer(window, this);
+  glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+}
+
+void Window::framebufferResizeCallback(GLFWwindow *window, int width,
+                                       int height) {
+  auto self = static_cast<Window *>(glfwGetWindowUserPointer(window));
+  self->width = width;
+  self->height = height;
+  self->framebufferResized = true;
 }
 
 bool Window::shouldClose() const { return glfwWindowShouldClose(window); }
 
 void Window::pollEvents() { glfwPollEvents(); }
+
+void Window::waitWhileMinimized() {
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window, &width, &height);
+  while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+    glfwWaitEvents();
+    glfwGetFramebufferSize(window, &width, &height);
+  }
+}
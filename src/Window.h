@@ -15,17 +15,24 @@ public:
 
   bool shouldClose() const;
   void pollEvents();
+  // Blocks while the framebuffer has zero area, i.e. the window is minimized.
+  void waitWhileMinimized();
   GLFWwindow *getGLFWWindow() const { return window; }
   int getWidth() const { return width; }
   int getHeight() const { return height; }
+  bool wasResized() const { return framebufferResized; }
+  void resetResized() { framebufferResized = false; }
 
 private:
   GLFWwindow *window;
   int width;
   int height;
   std::string title;
+  bool framebufferResized = false;
 
   void initWindow();
+  static void framebufferResizeCallback(GLFWwindow *window, int width,
+                                        int height);
 };
 
 #endif
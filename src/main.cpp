@@ -2,9 +2,9 @@
 #include <cstdlib>
 #include <iostream>
 
-int main() {
+int main(int argc, char **argv) {
   try {
-    Application app;
+    Application app(Application::parseArguments(argc, argv));
     app.run();
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << std::endl;
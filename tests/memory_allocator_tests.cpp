@@ -0,0 +1,116 @@
+// memory_allocator_tests: drives VulkanMemoryAllocator on a headless device
+// and checks that defragmentation moves an allocation out of a sparse block
+// into a fuller one and releases the block it leaves empty. No resources are
+// bound, so any Vulkan driver will do.
+
+#include "VulkanDevice.h"
+#include "VulkanMemoryAllocator.h"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+void testDefragment(VulkanMemoryAllocator &allocator) {
+  VkMemoryRequirements requirements{};
+  requirements.size = 1024 * 1024;
+  requirements.alignment = 256;
+  requirements.memoryTypeBits = ~0u;
+
+  auto allocate = [&]() {
+    return allocator.allocate(requirements,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+  };
+
+  // Fill until a second new block is needed: the block before it ends up
+  // full and the newest one holds a single allocation.
+  std::vector<VulkanAllocation> fillers;
+  fillers.push_back(allocate());
+  uint32_t heap = allocator.heapOf(fillers[0].memoryType);
+  uint32_t startBlocks = allocator.getStats()[heap].blockCount;
+  while (allocator.getStats()[heap].blockCount < startBlocks + 2 &&
+         fillers.size() < 1024) {
+    fillers.push_back(allocate());
+  }
+  uint32_t blocks = allocator.getStats()[heap].blockCount;
+  check(blocks == startBlocks + 2, "filling allocates new blocks");
+
+  VulkanAllocation lone = fillers.back();
+  fillers.pop_back();
+  check(lone.block != nullptr && lone.block != fillers.back().block,
+        "the last allocation sits alone in the newest block");
+
+  // Room in the full block for the lone allocation to move to.
+  VulkanAllocation freed = fillers.back();
+  fillers.pop_back();
+  allocator.free(freed);
+
+  VkDeviceMemory sourceMemory = lone.memory;
+  uint32_t moves = 0;
+  VkDeviceMemory targetMemory = VK_NULL_HANDLE;
+  VkDeviceSize moved = allocator.defragment(
+      {&lone}, [&](const VulkanAllocation &from, const VulkanAllocation &to) {
+        moves++;
+        targetMemory = to.memory;
+        check(from.memory == sourceMemory && to.size == from.size,
+              "the move is from the sparse block, at the same size");
+        // A real callback creates and binds the replacement resource here,
+        // which takes the allocator's lock.
+        VulkanAllocation scratch = allocator.allocate(
+            requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+        allocator.free(scratch);
+      });
+
+  check(moves == 1 && moved == requirements.size,
+        "the lone allocation is moved once");
+  check(lone.memory == targetMemory && lone.memory != sourceMemory,
+        "the allocation is updated to where it moved");
+  check(allocator.getStats()[heap].blockCount == blocks - 1,
+        "the emptied block is released");
+
+  // The block the lone allocation moved into is full again and left alone.
+  moves = 0;
+  allocator.defragment({&fillers.back()},
+                       [&](const VulkanAllocation &, const VulkanAllocation &) {
+                         moves++;
+                       });
+  check(moves == 0, "allocations in busy blocks stay put");
+
+  allocator.free(lone);
+  for (auto &filler : fillers) {
+    allocator.free(filler);
+  }
+}
+
+} // namespace
+
+int main() {
+  try {
+    DeviceConfig config;
+    config.pipelineCachePath.clear();
+    config.deviceCachePath.clear();
+    config.verbose = false;
+
+    VulkanDevice device(VkExtent2D{64, 64}, config);
+    testDefragment(device.getMemoryAllocator());
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (failures > 0) {
+    std::cerr << failures << " memory allocator checks failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+// render_graph_tests: compiles a multi-pass frame on a headless device and
+// checks what VulkanRenderGraph worked out for it: culling, where transient
+// images alias and the barriers each pass gets. Nothing is recorded, so any
+// Vulkan driver will do.
+
+#include "VulkanDevice.h"
+#include "VulkanRenderGraph.h"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+using Usage = VulkanRenderGraph::Usage;
+
+int failures = 0;
+
+void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+const VulkanRenderGraph::Barrier *
+findBarrier(const VulkanRenderGraph &graph, VulkanRenderGraph::Pass pass,
+            VulkanRenderGraph::Resource resource) {
+  for (const auto &barrier : graph.getBarriers(pass)) {
+    if (barrier.resource == resource) return &barrier;
+  }
+  return nullptr;
+}
+
+void testMultiPassFrame(VulkanDevice &device) {
+  VulkanRenderGraph graph(device);
+
+  Usage sampled;
+  sampled.stage = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+  sampled.access = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+  sampled.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  Usage present;
+  present.layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkImageUsageFlags colorUsage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  auto target = graph.importImage("target", VK_IMAGE_ASPECT_COLOR_BIT, Usage(),
+                                  present);
+  auto depth = graph.createImage("depth", VK_FORMAT_D16_UNORM,
+                                 VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                 VK_IMAGE_ASPECT_DEPTH_BIT);
+  auto scene = graph.createImage("scene", VK_FORMAT_R8G8B8A8_UNORM, colorUsage,
+                                 VK_IMAGE_ASPECT_COLOR_BIT);
+  auto blurred = graph.createImage("blurred", VK_FORMAT_R8G8B8A8_UNORM,
+                                   colorUsage, VK_IMAGE_ASPECT_COLOR_BIT);
+  auto toneMapped = graph.createImage("tone_mapped", VK_FORMAT_R8G8B8A8_UNORM,
+                                      colorUsage, VK_IMAGE_ASPECT_COLOR_BIT);
+  auto debug = graph.createImage("debug", VK_FORMAT_R8G8B8A8_UNORM, colorUsage,
+                                 VK_IMAGE_ASPECT_COLOR_BIT);
+
+  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+  VkClearValue clearDepth{};
+  clearDepth.depthStencil = {1.0f, 0};
+  auto nothing = [](VkCommandBuffer) {};
+
+  auto prepass = graph.addPass("depth_prepass", nothing);
+  graph.setDepthAttachment(prepass, depth, clearDepth);
+
+  auto mainPass = graph.addPass("main", nothing);
+  graph.addColorAttachment(mainPass, scene, clearColor);
+  graph.setDepthAttachment(mainPass, depth);
+
+  auto blur = graph.addPass("blur", nothing);
+  graph.read(blur, scene, sampled);
+  graph.addColorAttachment(blur, blurred, clearColor);
+
+  auto toneMap = graph.addPass("tone_map", nothing);
+  graph.read(toneMap, blurred, sampled);
+  graph.addColorAttachment(toneMap, toneMapped, clearColor);
+
+  // Nothing reads what it renders.
+  auto unused = graph.addPass("debug_view", nothing);
+  graph.read(unused, scene, sampled);
+  graph.addColorAttachment(unused, debug, clearColor);
+
+  auto compose = graph.addPass("compose", nothing);
+  graph.read(compose, toneMapped, sampled);
+  graph.addColorAttachment(compose, target, clearColor);
+
+  graph.compile({256, 256});
+
+  check(graph.getCulledPassCount() == 1 && graph.isPassCulled(unused),
+        "only the pass nobody reads from is culled");
+
+  // scene lives over main and blur, tone_mapped over tone_map and compose,
+  // so they can share memory; blurred overlaps both.
+  check(graph.getMemoryOffset(scene) == graph.getMemoryOffset(toneMapped),
+        "scene and tone_mapped alias");
+  check(graph.getMemoryOffset(blurred) != graph.getMemoryOffset(scene),
+        "blurred does not alias images alive at the same time");
+  check(graph.getTransientMemorySize() < graph.getUnaliasedMemorySize(),
+        "aliasing saves memory");
+
+  // The previous frame may still be testing against depth when the next
+  // prepass clears it.
+  const auto *depthClear = findBarrier(graph, prepass, depth);
+  check(depthClear != nullptr &&
+            (depthClear->src.stage &
+             VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT) &&
+            depthClear->dst.layout ==
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        "depth's first use waits for the previous frame's depth tests");
+
+  // scene takes over tone_mapped's memory, which compose samples last.
+  const auto *sceneClear = findBarrier(graph, mainPass, scene);
+  check(sceneClear != nullptr &&
+            (sceneClear->src.stage & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT) &&
+            sceneClear->src.layout == VK_IMAGE_LAYOUT_UNDEFINED,
+        "scene's first use waits for the last use of the memory it aliases");
+
+  // Depth stays in its layout from the prepass to main, but main tests
+  // against what the prepass wrote.
+  const auto *depthLoad = findBarrier(graph, mainPass, depth);
+  check(depthLoad != nullptr &&
+            (depthLoad->src.access &
+             VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) &&
+            depthLoad->src.layout == depthLoad->dst.layout,
+        "main waits for the prepass's depth writes without a transition");
+
+  // One batch per pass: blur makes scene readable and starts blurred.
+  check(graph.getBarriers(blur).size() == 2, "blur gets a batch of two");
+  const auto *sceneRead = findBarrier(graph, blur, scene);
+  check(sceneRead != nullptr &&
+            sceneRead->src.stage ==
+                VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT &&
+            sceneRead->src.access == VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT &&
+            sceneRead->dst.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        "blur samples scene after main's writes");
+
+  check(graph.getBarriers(unused).empty(), "a culled pass gets no barriers");
+
+  graph.cleanup();
+}
+
+} // namespace
+
+int main() {
+  try {
+    DeviceConfig config;
+    config.pipelineCachePath.clear();
+    config.deviceCachePath.clear();
+    config.verbose = false;
+
+    VulkanDevice device(VkExtent2D{64, 64}, config);
+    testMultiPassFrame(device);
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (failures > 0) {
+    std::cerr << failures << " render graph checks failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}